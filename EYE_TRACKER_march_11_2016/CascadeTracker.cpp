@@ -0,0 +1,199 @@
+/*******************************************************************************************************************//**
+* @file CascadeTracker.cpp
+* @brief Implementation for the CascadeTracker class
+*
+* This class runs the cheap canny edge based pupil tracker first, and only falls back to the robust pupil tracker when
+* the cheap result is not supported by the image evidence
+***********************************************************************************************************************/
+
+#include "CascadeTracker.h"
+#include "opencv2/imgproc/imgproc.hpp"
+#include <math.h>
+#include <stdio.h>
+
+/*******************************************************************************************************************//**
+* @brief Constructor to create a CascadeTracker
+***********************************************************************************************************************/
+CascadeTracker::CascadeTracker()
+{
+    // initialize validation variables
+    m_min_confidence = 0.6f;
+    m_min_gradient_support = 0.7f;
+    m_min_contrast = 8;
+    m_gradient_samples = 64;
+    m_gradient_offset = 2.0f;
+
+    resetStatistics();
+}
+
+/*******************************************************************************************************************//**
+* @brief Attempt to fit a pupil ellipse in the eye image frame
+*
+* The canny tracker ellipse is validated against the edge evidence (its confidence) and the gradient evidence (the
+* image gets brighter outwards across the boundary). The robust tracker is only run when the validation fails.
+*
+* @param[in] imageIn the input OpenCV image
+* @return true if the a pupil was located in the image
+***********************************************************************************************************************/
+bool CascadeTracker::findPupil(const cv::Mat& imageIn)
+{
+    m_frames++;
+
+    // run the cheap tracker
+    int64 startTicks = cv::getTickCount();
+    const bool cheapSuccess = m_cheapTracker.findPupil(imageIn);
+    bool valid = false;
+    if(cheapSuccess && m_cheapTracker.getConfidence() >= m_min_confidence)
+    {
+        cv::Mat imageGray = imageIn;
+        if(imageIn.channels() == 3)
+        {
+            cv::cvtColor(imageIn, m_grayImage, CV_BGR2GRAY);
+            imageGray = m_grayImage;
+        }
+        else if(imageIn.channels() == 4)
+        {
+            cv::cvtColor(imageIn, m_grayImage, CV_BGRA2GRAY);
+            imageGray = m_grayImage;
+        }
+        valid = gradientSupport(imageGray, m_cheapTracker.getEllipseRectangle()) >= m_min_gradient_support;
+    }
+    m_cheapSeconds += (cv::getTickCount() - startTicks) / cv::getTickFrequency();
+
+    if(valid)
+    {
+        m_cheapAccepted++;
+        m_ellipseRectangle = m_cheapTracker.getEllipseRectangle();
+        return true;
+    }
+
+    // fall back to the robust tracker, seeded with the cheap estimate if there is one
+    const cv::RotatedRect seed = cheapSuccess ? m_cheapTracker.getEllipseRectangle() : cv::RotatedRect();
+    startTicks = cv::getTickCount();
+    bool robustSuccess = m_robustTracker.findPupil(imageIn, seed);
+    if(!robustSuccess && cheapSuccess)
+    {
+        // the cheap estimate may have been wrong altogether, so search the whole image
+        robustSuccess = m_robustTracker.findPupil(imageIn, cv::RotatedRect());
+    }
+    m_robustSeconds += (cv::getTickCount() - startTicks) / cv::getTickFrequency();
+    m_robustRuns++;
+
+    if(robustSuccess)
+    {
+        m_robustFound++;
+        m_ellipseRectangle = m_robustTracker.getEllipseRectangle();
+    }
+    return robustSuccess;
+}
+
+/*******************************************************************************************************************//**
+* @brief Measures how well the image gradient across an ellipse boundary matches a dark pupil
+*
+* Samples the boundary at evenly spaced parameter angles, and compares the intensity just outside the boundary with
+* the intensity just inside it, along the ellipse normal
+*
+* @param[in] imageGray the grayscale eye image
+* @param[in] ellipse the pupil ellipse in image coordinates
+* @return the fraction of boundary samples which get brighter outwards by at least the minimum contrast
+***********************************************************************************************************************/
+float CascadeTracker::gradientSupport(const cv::Mat& imageGray, const cv::RotatedRect& ellipse)
+{
+    const float a = ellipse.size.width / 2;
+    const float b = ellipse.size.height / 2;
+    if(a < 1 || b < 1 || m_gradient_samples <= 0)
+    {
+        return 0;
+    }
+    const float theta = static_cast<float>(ellipse.angle * CV_PI / 180.0);
+    const float c = cos(theta);
+    const float s = sin(theta);
+
+    int supported = 0;
+    for(int i = 0; i < m_gradient_samples; i++)
+    {
+        // boundary point and outward normal in the ellipse frame
+        const float t = static_cast<float>(2 * CV_PI * i / m_gradient_samples);
+        const float px = a * cos(t);
+        const float py = b * sin(t);
+        float nx = b * cos(t);
+        float ny = a * sin(t);
+        const float norm = sqrt(nx * nx + ny * ny);
+        nx /= norm;
+        ny /= norm;
+
+        // rotate into the image and step across the boundary
+        const float x = ellipse.center.x + c * px - s * py;
+        const float y = ellipse.center.y + s * px + c * py;
+        const float dx = m_gradient_offset * (c * nx - s * ny);
+        const float dy = m_gradient_offset * (s * nx + c * ny);
+        const cv::Point inner(cvRound(x - dx), cvRound(y - dy));
+        const cv::Point outer(cvRound(x + dx), cvRound(y + dy));
+
+        // samples off the image count against the ellipse
+        const cv::Rect bounds(0, 0, imageGray.cols, imageGray.rows);
+        if(!bounds.contains(inner) || !bounds.contains(outer))
+        {
+            continue;
+        }
+        if(imageGray.at<uchar>(outer) - imageGray.at<uchar>(inner) >= m_min_contrast)
+        {
+            supported++;
+        }
+    }
+    return static_cast<float>(supported) / m_gradient_samples;
+}
+
+/*******************************************************************************************************************//**
+* @brief Lets the main function grab the results of the pupils properties
+***********************************************************************************************************************/
+cv::RotatedRect CascadeTracker::getEllipseRectangle()
+{
+    return m_ellipseRectangle;
+}
+
+/*******************************************************************************************************************//**
+* @brief Sets the display mode for the canny tracker stage
+***********************************************************************************************************************/
+void CascadeTracker::setDisplay(bool display)
+{
+    m_cheapTracker.setDisplay(display);
+}
+
+/*******************************************************************************************************************//**
+* @brief Prints the cascade hit rate and the average cost of each stage
+*
+* The saving is estimated against running the robust tracker on every frame at its measured average cost
+***********************************************************************************************************************/
+void CascadeTracker::printStatistics()
+{
+    if(m_frames == 0)
+    {
+        return;
+    }
+    const double cheapMs = 1000.0 * m_cheapSeconds / m_frames;
+    const double robustMs = m_robustRuns > 0 ? 1000.0 * m_robustSeconds / m_robustRuns : 0.0;
+    const double frameMs = 1000.0 * (m_cheapSeconds + m_robustSeconds) / m_frames;
+    std::printf("Cascade: %u frames, canny accepted %.1f%%, robust run %.1f%% (found %u)\n", m_frames,
+        100.0 * m_cheapAccepted / m_frames, 100.0 * m_robustRuns / m_frames, m_robustFound);
+    std::printf("Cascade cost (ms): canny %.2f per frame, robust %.2f per run, cascade %.2f per frame", cheapMs, robustMs,
+        frameMs);
+    if(m_robustRuns > 0)
+    {
+        std::printf(", saving %.1f%% over robust only", 100.0 * (1.0 - frameMs / robustMs));
+    }
+    std::printf("\n");
+}
+
+/*******************************************************************************************************************//**
+* @brief Resets the cascade counters
+***********************************************************************************************************************/
+void CascadeTracker::resetStatistics()
+{
+    m_frames = 0;
+    m_cheapAccepted = 0;
+    m_robustRuns = 0;
+    m_robustFound = 0;
+    m_cheapSeconds = 0;
+    m_robustSeconds = 0;
+}
@@ -0,0 +1,69 @@
+/**********************************************************************************************************************
+* @file CascadeTracker.h
+* @brief Header for the CascadeTracker class
+*
+* This class runs the cheap canny edge based pupil tracker first, and only falls back to the robust pupil tracker when
+* the cheap result is not supported by the image evidence
+***********************************************************************************************************************/
+
+#ifndef CASCADE_TRACKER_H
+#define CASCADE_TRACKER_H
+
+#include <opencv2/core/core.hpp>
+#include "PupilTracker.h"
+#include "SwirskiTracker.h"
+
+/**********************************************************************************************************************
+* @class CascadeTracker
+*
+* @brief Class for tracking pupils with a cascade of the canny edge based and robust pupil trackers
+*
+* The canny tracker result is accepted when its ellipse confidence is high and the image gets brighter across the
+* ellipse boundary. Otherwise the robust tracker is run, seeded with the canny ellipse when there is one.
+***********************************************************************************************************************/
+class CascadeTracker {
+private:
+
+    // define the cascade stages
+    PupilTracker m_cheapTracker;
+    SwirskiTracker m_robustTracker;
+
+    // define tracking result parameters
+    cv::RotatedRect m_ellipseRectangle;
+
+    // define validation variables
+    float m_min_confidence;
+    float m_min_gradient_support;
+    int m_min_contrast;
+    int m_gradient_samples;
+    float m_gradient_offset;
+
+    // storage for the grayscale image of colour input
+    cv::Mat m_grayImage;
+
+    // define cascade counters
+    unsigned int m_frames;
+    unsigned int m_cheapAccepted;
+    unsigned int m_robustRuns;
+    unsigned int m_robustFound;
+    double m_cheapSeconds;
+    double m_robustSeconds;
+
+public:
+
+    // constructors
+    CascadeTracker();
+
+    // accessors
+    cv::RotatedRect getEllipseRectangle();
+
+    // utility functions
+    bool findPupil(const cv::Mat &imageIn);
+    float gradientSupport(const cv::Mat &imageGray, const cv::RotatedRect &ellipse);
+
+    void setDisplay(bool display);
+
+    void printStatistics();
+    void resetStatistics();
+};
+#endif // CASCADE_TRACKER_H
@@ -14,6 +14,11 @@
 #include "opencv2/highgui/highgui.hpp"
 #include <math.h>
 #include <iostream>
+#include <limits>
+#include <algorithm>
+
+#include "cvx.h"
+#include "EllipseFitCv.h"
 
 typedef std::vector<std::vector<cv::Point> > Contours_2D;
 typedef std::vector<cv::Point> Contour_2D;
@@ -30,7 +35,7 @@ typedef std::vector<int> ContourIndices;
 PupilTracker::PupilTracker()
 {
     // initialize tracking processing variables
-    m_courseDetection = false;
+    m_courseDetection = true;
     m_coarse_filter_min = 100;
     m_coarse_filter_max = 400;
 
@@ -46,6 +51,7 @@ PupilTracker::PupilTracker()
     m_glintIntensityOffset = 5;
 
     m_min_contour_size = 400;
+    m_fillContours = false;
 
     m_inital_ellipse_fit_threshhold = static_cast<float>(1.8);
     m_min_ratio = 0.3f;
@@ -55,223 +61,1170 @@ PupilTracker::PupilTracker()
     m_strong_perimeter_ratio_range = cv::Point2f(0.8f, 1.1f);
     m_strong_area_ratio_range = cv::Point2f(0.6f, 1.1f);
     m_final_perimeter_ratio_range = cv::Point2f(0.6f, 1.2f);
-    m_strong_prior = 0;
+    m_has_strong_prior = false;
 
     m_confidence = 0;
 
+    m_min_edge_contour_size = 80;
+    m_max_combine_evals = 1000;
+    m_max_combine_depth = 5;
+    m_candidate_padding = 0;
+
+    m_tracking = false;
+    m_tracking_confidence = 0.7f;
+    m_tracking_window_scale = 2.0f;
+    m_fit_residual_sigma = 1.0f;
+
+    // build the structuring elements used by the mask and eyelash filters
+    m_morphKernel = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(7, 7));
+    m_openKernel = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(9, 9));
+
     // debug settings
     m_display = false;
 }
 
+/*******************************************************************************************************************//**
+* @brief Sizes a buffer as a view on the top left corner of its storage, which only grows
+*
+* The pupil region changes size from frame to frame, and cv::Mat::create reallocates whenever the size changes. The
+* storage is instead kept at the largest size seen so far and the buffer is narrowed to a view of the requested size,
+* so later calls to create with that size leave it alone.
+*
+* @param[in,out] buffer the buffer, which becomes a view of the requested size
+* @param[in] size the requested size
+* @param[in] type the requested type
+***********************************************************************************************************************/
+static void reuseBuffer(cv::Mat& buffer, const cv::Size& size, int type)
+{
+    cv::Size storageSize;
+    cv::Point offset;
+    if(!buffer.empty())
+    {
+        buffer.locateROI(storageSize, offset);
+    }
+    if(buffer.empty() || buffer.type() != type || storageSize.width < size.width || storageSize.height < size.height)
+    {
+        buffer.create(std::max(size.height, storageSize.height), std::max(size.width, storageSize.width), type);
+    }
+    buffer.adjustROI(0, size.height - buffer.rows, 0, size.width - buffer.cols);
+}
+
+/*******************************************************************************************************************//**
+* @brief Gets the luma plane of an image and its histogram in a single pass
+*
+* Colour rows are converted one at a time and histogrammed while they are still in cache. The histogram is counted
+* into four interleaved tables, so that runs of equal pixels do not stall on the same counter.
+*
+* @param[in] image the single channel or colour image
+* @param[in] colorConversion the cvtColor code for colour images, or -1 for single channel images
+* @param[in,out] buffer storage for the converted luma plane of colour images
+* @param[out] luma the luma plane, sharing the input data for single channel images
+* @param[out] histogram the 256 bin histogram of the luma plane
+***********************************************************************************************************************/
+static void lumaHistogram(const cv::Mat& image, int colorConversion, cv::Mat& buffer, cv::Mat& luma, int histogram[256])
+{
+    if(colorConversion >= 0)
+    {
+        reuseBuffer(buffer, image.size(), CV_8UC1);
+        luma = buffer;
+    }
+    else
+    {
+        luma = image;
+    }
+
+    int counts[4][256] = {{0}};
+    for(int y = 0; y < luma.rows; y++)
+    {
+        if(colorConversion >= 0)
+        {
+            cv::Mat lumaRow = luma.row(y);
+            cv::cvtColor(image.row(y), lumaRow, colorConversion);
+        }
+
+        const uchar* row = luma.ptr<uchar>(y);
+        int x = 0;
+        for(; x + 4 <= luma.cols; x += 4)
+        {
+            counts[0][row[x]]++;
+            counts[1][row[x + 1]]++;
+            counts[2][row[x + 2]]++;
+            counts[3][row[x + 3]]++;
+        }
+        for(; x < luma.cols; x++)
+        {
+            counts[0][row[x]]++;
+        }
+    }
+
+    for(int i = 0; i < 256; i++)
+    {
+        histogram[i] = counts[0][i] + counts[1][i] + counts[2][i] + counts[3][i];
+    }
+}
+
+/*******************************************************************************************************************//**
+* @brief Maps a threshold on the normalized image back to the unnormalized image
+* @param[in] normalizeLut the monotonic normalisation lookup table
+* @param[in] threshold the inclusive upper threshold on normalized values
+* @return the largest unnormalized value at or below the threshold, or -1 if there is none
+***********************************************************************************************************************/
+static int rawThreshold(const uchar normalizeLut[256], int threshold)
+{
+    int value = -1;
+    while(value < 255 && normalizeLut[value + 1] <= threshold)
+    {
+        value++;
+    }
+    return value;
+}
+
 /*******************************************************************************************************************//**
 * @brief Attempt to fit a pupil ellipse in the eye image frame
+*
+* While the last pupil was found with high confidence, only a window around it is searched. If that search loses the
+* pupil, the same frame is searched again from scratch and tracking resumes once the confidence is high again.
+*
 * @param[in] imageIn the input OpenCV image
-* @param[out] result the output tracking data
 * @return true if the a pupil was located in the image
 * @author Christopher D. McMurrough
-* @author Krishna Bhattarai
 ***********************************************************************************************************************/
 bool PupilTracker::findPupil(const cv::Mat& imageIn)
+{
+    bool success = false;
+    if(m_tracking)
+    {
+        success = detectPupil(imageIn, true);
+        if(!success || m_confidence < m_tracking_confidence)
+        {
+            success = detectPupil(imageIn, false);
+        }
+    }
+    else
+    {
+        success = detectPupil(imageIn, false);
+    }
+
+    m_tracking = success && m_confidence >= m_tracking_confidence;
+    return success;
+}
+
+/*******************************************************************************************************************//**
+* @brief Attempt to fit a pupil ellipse in a region of the eye image frame
+* @param[in] imageIn the input OpenCV image
+* @param[in] useTrackingWindow search only the window around the last ellipse, rather than the coarse pupil region
+* @return true if the a pupil was located in the image
+***********************************************************************************************************************/
+bool PupilTracker::detectPupil(const cv::Mat& imageIn, bool useTrackingWindow)
 {
     bool success = false;
 
     // get the normalized grayscale image
-    if(!m_display)
+    if(m_display)
     {
         cv::imshow("infrared ", imageIn);
     }
 
+    // single channel input is already the luma plane, so only colour frames need converting
     const int rangeMin = 0;
     const int rangeMax = 255;
-    cv::Mat imageGray;
-    cv::cvtColor(imageIn, imageGray, cv::COLOR_BGR2GRAY);
-    cv::normalize(imageGray, imageGray, rangeMin, rangeMax, cv::NORM_MINMAX, CV_8UC1);
-    if(!m_display)
+    int colorConversion;
+    if(imageIn.channels() == 1)
+    {
+        colorConversion = -1;
+    }
+    else if(imageIn.channels() == 3)
+    {
+        colorConversion = cv::COLOR_BGR2GRAY;
+    }
+    else if(imageIn.channels() == 4)
+    {
+        colorConversion = cv::COLOR_BGRA2GRAY;
+    }
+    else
+    {
+        return false;
+    }
+
+    // restrict every later stage to the tracking window or the coarse pupil region (the coarse filter needs the luma
+    // of the whole frame)
+    cv::Mat imageSource = imageIn;
+    m_pupilRoi = cv::Rect(0, 0, imageIn.cols, imageIn.rows);
+    m_candidate_padding = imageIn.rows / 16.0f;
+    if(useTrackingWindow)
+    {
+        const int radius = cvRound(std::max(m_ellipseRectangle.size.width, m_ellipseRectangle.size.height) * m_tracking_window_scale / 2);
+        const cv::Point center(cvRound(m_ellipseRectangle.center.x), cvRound(m_ellipseRectangle.center.y));
+        m_pupilRoi = cv::Rect(center.x - radius, center.y - radius, 2 * radius + 1, 2 * radius + 1) & m_pupilRoi;
+        m_candidate_padding = radius / 4.0f;
+    }
+    else if(m_courseDetection)
+    {
+        if(colorConversion >= 0)
+        {
+            reuseBuffer(m_lumaImage, imageIn.size(), CV_8UC1);
+            cv::cvtColor(imageIn, m_lumaImage, colorConversion);
+            imageSource = m_lumaImage;
+            colorConversion = -1;
+        }
+        findCoarsePupilRoi(imageSource, m_pupilRoi);
+    }
+
+    // convert to luma and histogram the pupil region in a single pass
+    cv::Mat imagePupil;
+    int rawHistogram[256];
+    lumaHistogram(cv::Mat(imageSource, m_pupilRoi), colorConversion, m_lumaImage, imagePupil, rawHistogram);
+
+    // find the intensity range from the first and last occupied bins
+    int minValue = 0;
+    while(minValue < 255 && rawHistogram[minValue] == 0)
+    {
+        minValue++;
+    }
+    int maxValue = 255;
+    while(maxValue > 0 && rawHistogram[maxValue] == 0)
+    {
+        maxValue--;
+    }
+
+    // fold the min-max normalisation into a lookup table (as cv::normalize computes it), which is applied to the
+    // histogram and thresholds rather than to the image
+    const double normalizeScale = maxValue > minValue ? static_cast<double>(rangeMax - rangeMin) / (maxValue - minValue) : 0.0;
+    uchar normalizeLut[256];
+    for(int i = 0; i < 256; i++)
     {
-        cv::imshow("imageGray", imageGray);
+        normalizeLut[i] = cv::saturate_cast<uchar>(i * normalizeScale + rangeMin - minValue * normalizeScale);
+    }
+    if(m_display)
+    {
+        cv::LUT(imagePupil, cv::Mat(1, 256, CV_8UC1, normalizeLut), m_imageGray);
+        cv::imshow("imageGray", m_imageGray);
     }
 
-    // Alternative implementation of Histogram spikes
-    cv::Mat histogram;
-    int histSize;
-    histSize = 256; //from 0 to 255
-    /// Set the ranges
-    float range[] = { 0, 256 } ; //the upper boundary is exclusive
-    const float* histRange = { range };
-    cv::calcHist(&imageGray, 1 , 0, cv::Mat(), histogram , 1 , &histSize, &histRange, true, false);
+    // Alternative implementation of Histogram spikes, on the histogram of the normalized image
+    m_histogram.create(256, 1, CV_32FC1);
+    m_histogram.setTo(0);
+    for(int i = 0; i < 256; i++)
+    {
+        m_histogram.at<float>(normalizeLut[i], 0) += rawHistogram[i];
+    }
 
     int lowest_spike_index = 255;
     int highest_spike_index = 0;
     float max_intensity = 0;
 
-    PupilTracker::calculate_spike_indices_and_max_intenesity(histogram, 40, lowest_spike_index, highest_spike_index, max_intensity);
+    PupilTracker::calculate_spike_indices_and_max_intenesity(m_histogram, 40, lowest_spike_index, highest_spike_index, max_intensity);
     // Alternative implementation of histogram spikes ends here
 
     m_bin_thresh = lowest_spike_index;
 
     // create a mask for the dark pupil area (assign white to pupil area)
-    cv::Mat darkMask;
-    cv::inRange(imageGray, cv::InputArray(rangeMin), cv::InputArray(lowest_spike_index + m_pupilIntensityOffset), darkMask);
-    const cv::Mat morphKernel = getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(7, 7));
-    cv::dilate(darkMask, darkMask, morphKernel, cv::Point(-1, -1), 2);
-    if(!m_display)
+    const int darkThreshold = rawThreshold(normalizeLut, lowest_spike_index + m_pupilIntensityOffset);
+    reuseBuffer(m_darkMask, imagePupil.size(), CV_8UC1);
+    cv::inRange(imagePupil, cv::InputArray(rangeMin), cv::InputArray(darkThreshold), m_darkMask);
+    cv::dilate(m_darkMask, m_darkMask, m_morphKernel, cv::Point(-1, -1), 2);
+    if(m_display)
     {
-        cv::imshow("darkMask", darkMask);
+        cv::imshow("darkMask", m_darkMask);
     }
 
     // create a mask for the light glint area (assign black to glint area)
-    cv::Mat glintMask;
-    cv::inRange(imageGray, cv::InputArray(rangeMin), cv::InputArray(highest_spike_index - m_glintIntensityOffset), glintMask);
-    cv::erode(glintMask, glintMask, morphKernel, cv::Point(-1, -1), 1);
-    if(!m_display)
+    const int glintThreshold = rawThreshold(normalizeLut, highest_spike_index - m_glintIntensityOffset);
+    reuseBuffer(m_glintMask, imagePupil.size(), CV_8UC1);
+    cv::inRange(imagePupil, cv::InputArray(rangeMin), cv::InputArray(glintThreshold), m_glintMask);
+    cv::erode(m_glintMask, m_glintMask, m_morphKernel, cv::Point(-1, -1), 1);
+    if(m_display)
     {
-        cv::imshow("glintMask", glintMask);
+        cv::imshow("glintMask", m_glintMask);
     }
 
-    // remove eye lashes using an open morphology operation
-    cv::Mat imageEyeLash;
-    const cv::Mat openKernel = getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(9, 9));
-    cv::morphologyEx(imageGray, imageEyeLash, cv::MORPH_OPEN, openKernel);
-    if(!m_display)
+    // edges only survive inside the dark mask, so the filters below only run on its bounding region, plus an apron
+    // covering the footprints of the open, median and Canny operators, so the filter responses inside the mask are
+    // unchanged. Canny's hysteresis can still differ: a weak edge inside the mask that was only connected to a strong
+    // edge through pixels beyond the apron is dropped, so the edges inside the mask are nearly, not always, the same
+    cv::Rect darkRoi;
+    if(!getRoiWithoutBorder(m_darkMask, darkRoi))
     {
-        cv::imshow("eyeLash", imageEyeLash);
+        m_confidence = 0;
+        return false;
+    }
+    const int apron = 2 * (m_openKernel.rows / 2) + m_blur / 2 + m_canny_aperture / 2 + 1;
+    cv::Rect filterRoi(darkRoi.x - apron, darkRoi.y - apron, darkRoi.width + 2 * apron, darkRoi.height + 2 * apron);
+    filterRoi &= cv::Rect(0, 0, imagePupil.cols, imagePupil.rows);
+    const cv::Mat imageFilter(imagePupil, filterRoi);
+
+    // remove eye lashes using an open morphology operation (this and the median commute with the normalisation)
+    reuseBuffer(m_imageEyeLash, filterRoi.size(), CV_8UC1);
+    cv::morphologyEx(imageFilter, m_imageEyeLash, cv::MORPH_OPEN, m_openKernel);
+    if(m_display)
+    {
+        cv::imshow("eyeLash", m_imageEyeLash);
     }
     
 
-    // apply additional blurring
+    // apply additional blurring (the unblurred case only borrows the input, so it must not be kept in the member)
     cv::Mat imageBlurred;
     if(m_blur >= 1)
     {
-        cv::medianBlur(imageEyeLash, imageBlurred, m_blur);
-        //cv::medianBlur(imageGray, imageBlurred, m_blur);
+        reuseBuffer(m_imageBlurred, filterRoi.size(), CV_8UC1);
+        cv::medianBlur(m_imageEyeLash, m_imageBlurred, m_blur);
+        //cv::medianBlur(imageFilter, m_imageBlurred, m_blur);
+        imageBlurred = m_imageBlurred;
     }
     else
     {
         //imageBlurred = imageEyeLash;
-        imageBlurred = imageGray;
+        imageBlurred = imageFilter;
     }
 
-    // compute canny edges
-    cv::Mat edges;
-    cv::Canny(imageBlurred, edges, m_canny_thresh, m_canny_thresh * m_canny_ratio, m_canny_aperture);
-    if(!m_display)
+    // compute canny edges, scaling the thresholds down to the gradients of the unnormalized image
+    reuseBuffer(m_edges, imagePupil.size(), CV_8UC1);
+    m_edges.setTo(0);
+    cv::Mat edgesFilter(m_edges, filterRoi);
+    const double cannyThreshold = normalizeScale > 0 ? m_canny_thresh / normalizeScale : m_canny_thresh;
+    cv::Canny(imageBlurred, edgesFilter, cannyThreshold, cannyThreshold * m_canny_ratio, m_canny_aperture);
+    if(m_display)
     {
-        cv::imshow("edges", edges);
+        cv::imshow("edges", m_edges);
     }
 
     // remove edges outside of the white regions in the pupil and glint masks
-    cv::Mat edgesPruned;
-    cv::min(edges, darkMask, edgesPruned);
-    cv::min(edges, glintMask, edgesPruned);
+    reuseBuffer(m_edgesPruned, imagePupil.size(), CV_8UC1);
+    cv::min(m_edges, m_darkMask, m_edgesPruned);
+    cv::min(m_edgesPruned, m_glintMask, m_edgesPruned);
 
    
     if(m_display)
     {
 
-        cv::imshow("edgesPruned", edgesPruned);
+        cv::imshow("edgesPruned", m_edgesPruned);
     }
 
-    // compute the connected components out of the pupil edge candidates
-    cv::Mat my_clone = darkMask.clone();
-    cv::Mat connectedEdges = cv::Mat::zeros(my_clone.size(), CV_8UC1);
-    std::vector<std::vector<cv::Point> > contours;
-    cv::findContours(darkMask, contours, CV_RETR_LIST, CV_CHAIN_APPROX_NONE);
+    // evaluate ellipse candidates on the pruned edges
+    cv::RotatedRect candidateEllipse;
+    if(findEllipseCandidates(m_edgesPruned, candidateEllipse))
+    {
+        candidateEllipse.center += cv::Point2f(static_cast<float>(m_pupilRoi.x), static_cast<float>(m_pupilRoi.y));
+        m_ellipseRectangle = candidateEllipse;
+        return true;
+    }
+    m_confidence = 0;
+
+    // otherwise fall back to the moments of the dark region contours (kept in their own list, so that they and the edge
+    // contours do not resize each other's point storage)
+    cv::findContours(m_darkMask, m_darkContours, CV_RETR_LIST, CV_CHAIN_APPROX_NONE);
     // Alternatives 
     // cv::findContours(darkMask, contours, CV_RETR_TREE, CV_CHAIN_APPROX_SIMPLE);
     // cv::findContours(edgesPruned, contours, CV_RETR_TREE, CV_CHAIN_APPROX_NONE);
+    if(m_darkContours.empty())
+    {
+        return false;
+    }
 
-    bool retryContourMerge = true;
-    int relaxContourMerge = 0;
-    while(retryContourMerge && contours.size() > 0)
+    // merge the sufficiently large contours, relaxing the minimum size in steps of 2 until the largest one qualifies
+    size_t largestContour = 0;
+    for(size_t i = 0; i < m_darkContours.size(); i++)
     {
-        for(int i = 0; i < contours.size(); i++)
+        largestContour = std::max(largestContour, m_darkContours[i].size());
+    }
+    int minContourSize = m_min_contour_size;
+    if(static_cast<int>(largestContour) < minContourSize)
+    {
+        minContourSize -= 2 * ((minContourSize - static_cast<int>(largestContour) + 1) / 2);
+    }
+
+    // take the merged contours for fitting
+    // (the point storage is swapped between the two contour lists, so it is kept for the next frame)
+    size_t connectedCount = 0;
+    for(size_t i = 0; i < m_darkContours.size(); i++)
+    {
+        if(static_cast<int>(m_darkContours[i].size()) >= minContourSize)
         {
-            // merge the contour if sufficiently large
-            if(contours.at(i).size() < m_min_contour_size - relaxContourMerge)
-            {
-                continue;
-            }
-            else
+            if(connectedCount == m_connectedEdges.size())
             {
-                cv::drawContours(connectedEdges, contours, i, cv::Scalar(255), 2);
-                retryContourMerge = false;
+                m_connectedEdges.push_back(Contour_2D());
             }
+            m_connectedEdges[connectedCount++].swap(m_darkContours[i]);
         }
-        relaxContourMerge += 2;
     }
-  
+    m_connectedEdges.resize(connectedCount);
 
     if(m_display)
     {
-        cv::imshow("connectedEdges", connectedEdges);
+        cv::Mat connectedEdgesImage = cv::Mat::zeros(m_darkMask.size(), CV_8UC1);
+        cv::drawContours(connectedEdgesImage, m_connectedEdges, -1, cv::Scalar(255), 2);
+        cv::imshow("connectedEdges", connectedEdgesImage);
     }
    
     cv::RotatedRect my_rotated_rect_property;
-    my_rotated_rect_property = PupilTracker::getEllipseCentroid(connectedEdges);
-   
-    // this is where it crashes if the ellipse properties are not checked 
-    if (std::isnan(my_rotated_rect_property.center.x) || std::isnan(my_rotated_rect_property.center.y)  || std::isnan(my_rotated_rect_property.size.width) || std::isnan(my_rotated_rect_property.size.height) )
+
+    // this is where it crashes if the ellipse properties are not checked (the contours may have no area or points)
+    if (!PupilTracker::getEllipseCentroid(m_connectedEdges, my_rotated_rect_property))
     {
         success = false;
         return success;
     }
     else
     {
+        // move the ellipse from the pupil region back into image coordinates
+        cv::Point2f center = my_rotated_rect_property.center + cv::Point2f(m_pupilRoi.x, m_pupilRoi.y);
+        m_ellipseRectangle = cv::RotatedRect(center, my_rotated_rect_property.size, my_rotated_rect_property.angle);
+    }
+    return true;
+}
+
+
+/*******************************************************************************************************************//**
+* @brief Attempt to fit a pupil ellipse in a raw camera buffer
+*
+* Uses the luma plane of the buffer from cvx::lumaPlane, shared with the Swirski tracker. Mono8 and NV12 buffers are
+* tracked without copying, packed 4:2:2 and BGR buffers have their Y values gathered into a buffer that is reused
+* between frames.
+*
+* @param[in] data pointer to the first pixel of the camera buffer
+* @param[in] width the image width in pixels
+* @param[in] height the image height in pixels
+* @param[in] step the number of bytes per row of the buffer (of the Y plane for NV12)
+* @param[in] format the pixel layout of the buffer
+* @return true if the a pupil was located in the image
+* @author Christopher D. McMurrough
+***********************************************************************************************************************/
+bool PupilTracker::findPupil(const uchar* data, int width, int height, size_t step, cvx::PixelFormat format)
+{
+    return findPupil(cvx::lumaPlane(data, width, height, step, format, m_lumaBuffer));
+}
+
+/*******************************************************************************************************************//**
+* @brief Sums the pixels of a rectangle using an integral image
+***********************************************************************************************************************/
+static inline int integralAreaSum(const cv::Mat& integral, int x, int y, int width, int height)
+{
+    const int* top = integral.ptr<int>(y);
+    const int* bottom = integral.ptr<int>(y + height);
+    return bottom[x + width] - bottom[x] - top[x + width] + top[x];
+}
+
+/*******************************************************************************************************************//**
+* @brief Locates the coarse pupil region using a center-surround filter on the integral image
+*
+* C++ version of the eye_filter used by the pupil-labs canny detector. Square windows between m_coarse_filter_min and
+* m_coarse_filter_max wide are compared against a surround half their width on every side, and the window that is
+* darkest relative to its surround is taken as the pupil. The region is padded by an eighth of the window width.
+*
+* @param[in] imageGray the grayscale eye image
+* @param[out] roi the coarse pupil region, within the image bounds
+* @return true if the image was large enough to search
+***********************************************************************************************************************/
+bool PupilTracker::findCoarsePupilRoi(const cv::Mat& imageGray, cv::Rect& roi)
+{
+    // sum the image once, so that every window sum costs four lookups
+    cv::integral(imageGray, m_coarseIntegral, CV_32S);
+
+    double bestResponse = -std::numeric_limits<double>::infinity();
+    cv::Rect bestWindow;
+    const int maxWidth = std::min(imageGray.cols, imageGray.rows) / 2;
+    for(int width = m_coarse_filter_min; width < m_coarse_filter_max && width <= maxWidth; width += std::max(2, width / 16))
+    {
+        const int padding = width / 2;
+        const int outerWidth = width + 2 * padding;
+        const int step = std::max(1, width / 16);
+        const double innerArea = static_cast<double>(width) * width;
+        const double surroundArea = static_cast<double>(outerWidth) * outerWidth - innerArea;
 
-        m_ellipseRectangle = cv::RotatedRect(my_rotated_rect_property.center, my_rotated_rect_property.size, my_rotated_rect_property.angle);
+        for(int y = 0; y + outerWidth <= imageGray.rows; y += step)
+        {
+            for(int x = 0; x + outerWidth <= imageGray.cols; x += step)
+            {
+                const int innerSum = integralAreaSum(m_coarseIntegral, x + padding, y + padding, width, width);
+                const int outerSum = integralAreaSum(m_coarseIntegral, x, y, outerWidth, outerWidth);
+                const double response = (outerSum - innerSum) / surroundArea - innerSum / innerArea;
+                if(response > bestResponse)
+                {
+                    bestResponse = response;
+                    bestWindow = cv::Rect(x + padding, y + padding, width, width);
+                }
+            }
+        }
     }
+
+    if(bestWindow.area() == 0)
+    {
+        return false;
+    }
+
+    // pad the window so that the pupil edge is not cut off
+    const int padding = bestWindow.width / 8;
+    roi = cv::Rect(bestWindow.x - padding, bestWindow.y - padding, bestWindow.width + 2 * padding, bestWindow.height + 2 * padding);
+    roi &= cv::Rect(0, 0, imageGray.cols, imageGray.rows);
+
+    // candidate pupil centers must lie inside the window by the same padding
+    m_candidate_padding = 2.0f * padding;
     return true;
 }
 
+/*******************************************************************************************************************//**
+* @brief Runs a loop body over a range of indices on the OpenCV thread pool
+*
+* The body is held by value rather than in a std::function, which would allocate for lambdas capturing more than a
+* couple of references.
+***********************************************************************************************************************/
+template<typename Body>
+class ParallelIndexLoop : public cv::ParallelLoopBody
+{
+public:
+    explicit ParallelIndexLoop(const Body& body) : m_body(body)
+    {
+    }
+
+    virtual void operator()(const cv::Range& range) const
+    {
+        for(int i = range.start; i < range.end; i++)
+        {
+            m_body(i);
+        }
+    }
+
+private:
+    Body m_body;
+};
 
 /*******************************************************************************************************************//**
-* @brief This method utilizes moments to calculate the center of mass of a mask (dark or spectral)
-* @param[in] cv::Mat &mask 
-* @param[out] cv:: RotatedRect
-* @return cv::RotatedRect 
-* @author Krishna Bhattarai
+* @brief Wraps a loop body for cv::parallel_for_, deducing its type
 ***********************************************************************************************************************/
+template<typename Body>
+static inline ParallelIndexLoop<Body> parallelIndexLoop(const Body& body)
+{
+    return ParallelIndexLoop<Body>(body);
+}
 
-cv::RotatedRect PupilTracker::getEllipseCentroid(const cv::Mat &mask) 
+/*******************************************************************************************************************//**
+* @brief Measures the euclidian distance of points to an ellipse, as dist_pts_ellipse in pupil-labs methods.py
+***********************************************************************************************************************/
+class EllipseDistance
 {
-    //Even though it says centroid right now it is trying to return stuff needed for the
-    // rotated rectangle.
+public:
+    explicit EllipseDistance(const cv::RotatedRect& ellipse) : m_center(ellipse.center)
+    {
+        const double angle = ellipse.angle * CV_PI / 180.0;
+        m_cos = std::cos(angle);
+        m_sin = std::sin(angle);
+        m_rx = ellipse.size.width / 2.0;
+        m_ry = ellipse.size.height / 2.0;
+    }
 
-    cv::Moments m = moments(mask, true);
-    cv::RotatedRect ret;
-    ret.center.x = m.m10 / m.m00;
-    ret.center.y = m.m01 / m.m00;
-    double mu20 = m.m20 / m.m00 - ret.center.x * ret.center.x;
-    double mu02 = m.m02 / m.m00 - ret.center.y * ret.center.y;
-    double mu11 = m.m11 / m.m00 - ret.center.x * ret.center.y;
+    double operator()(const cv::Point& point) const
+    {
+        // rotate the point into the ellipse frame, and scale the ellipse to a unit circle
+        const double x = point.x - m_center.x;
+        const double y = point.y - m_center.y;
+        const double px = (x * m_cos + y * m_sin) / m_rx;
+        const double py = (-x * m_sin + y * m_cos) / m_ry;
+        const double magnitude = std::sqrt(px * px + py * py);
+        if(magnitude == 0)
+        {
+            return std::min(m_rx, m_ry);
+        }
 
-    double common = std::sqrt(pow((mu20 - mu02), 2) + 4 * pow((mu11), 2));
-    ret.size.width = std::sqrt(2 * (mu20 + mu02 + common)) + 5;
-    ret.size.height = std::sqrt(2 * (mu20 + mu02 - common)) + 5;
+        // scale the offset to the unit circle back to image units
+        const double ratio = std::abs(magnitude - 1) / magnitude;
+        const double ex = px * ratio * m_rx;
+        const double ey = py * ratio * m_ry;
+        return std::sqrt(ex * ex + ey * ey);
+    }
 
-    double num, den;
-    if (mu02 > mu20) {
-        num = mu02 - mu20 + common;
-        den = 2 * mu11;
+private:
+    cv::Point2f m_center;
+    double m_cos;
+    double m_sin;
+    double m_rx;
+    double m_ry;
+};
 
-    } else {
-        num = 2 * mu11;
-        den = mu20 - mu02 + common;
+/*******************************************************************************************************************//**
+* @brief Approximates the circumference of an ellipse (Ramanujan)
+***********************************************************************************************************************/
+static inline double ellipseCircumference(const cv::RotatedRect& ellipse)
+{
+    const double a = ellipse.size.width / 2.0;
+    const double b = ellipse.size.height / 2.0;
+    return CV_PI * std::abs(3 * (a + b) - std::sqrt(10 * a * b + 3 * (a * a + b * b)));
+}
+
+/*******************************************************************************************************************//**
+* @brief Computes the mean squared distance of points to an ellipse
+***********************************************************************************************************************/
+static double ellipseFitVariance(const cv::RotatedRect& ellipse, const cv::Point* points, int count)
+{
+    const EllipseDistance distance(ellipse);
+    double sum = 0;
+    for(int i = 0; i < count; i++)
+    {
+        const double d = distance(points[i]);
+        sum += d * d;
     }
+    return sum / count;
+}
 
-    if (num == 0 && den == 0)
-        ret.angle = 0;
-    else
-        ret.angle = (180 / M_PI) * std::atan2(num, den);
+/*******************************************************************************************************************//**
+* @brief Finds the edge pixels within 1.3 pixels of an ellipse, as ellipse_true_support in the pupil-labs detector
+* @param[in] ellipse the candidate ellipse
+* @param[in] edges the edge pixels
+* @param[out] support the supporting edge pixels, or NULL if only the count is needed
+* @return the number of supporting edge pixels
+***********************************************************************************************************************/
+static int ellipseTrueSupport(const cv::RotatedRect& ellipse, const std::vector<cv::Point>& edges, std::vector<cv::Point>* support)
+{
+    const EllipseDistance distance(ellipse);
+    int count = 0;
+    for(size_t i = 0; i < edges.size(); i++)
+    {
+        if(distance(edges[i]) <= 1.3)
+        {
+            count++;
+            if(support != NULL)
+            {
+                support->push_back(edges[i]);
+            }
+        }
+    }
+    return count;
+}
+
+/*******************************************************************************************************************//**
+* @brief Scores how well an ellipse is supported by the edge pixels
+*
+* Multiplies the fraction of the ellipse circumference covered by supporting edge pixels (within 1.3 pixels) with a
+* gaussian weight of their RMS distance to the ellipse, so short or ragged supports both lower the score.
+*
+* @param[in] ellipse the fitted ellipse
+* @param[in] edges the edge pixels
+* @param[in] residualSigma the RMS distance at which the residual weight drops to exp(-1/2)
+* @return the confidence between 0 and 1
+***********************************************************************************************************************/
+static float ellipseConfidence(const cv::RotatedRect& ellipse, const std::vector<cv::Point>& edges, double residualSigma)
+{
+    const EllipseDistance distance(ellipse);
+    int count = 0;
+    double squaredSum = 0;
+    for(size_t i = 0; i < edges.size(); i++)
+    {
+        const double d = distance(edges[i]);
+        if(d <= 1.3)
+        {
+            count++;
+            squaredSum += d * d;
+        }
+    }
+    const double circumference = ellipseCircumference(ellipse);
+    if(count == 0 || circumference <= 0)
+    {
+        return 0;
+    }
+
+    const double supportRatio = std::min(1.0, count / circumference);
+    const double meanSquaredResidual = squaredSum / count;
+    return static_cast<float>(supportRatio * std::exp(-meanSquaredResidual / (2 * residualSigma * residualSigma)));
+}
+
+/*******************************************************************************************************************//**
+* @brief Finds the indices at which a polyline kinks or changes its direction of curvature
+*
+* Combines GetAnglesPolyline and find_kink_and_dir_change from pupil-labs methods.py. The curvature at each inner
+* vertex is the signed angle between its two edges; an index is reported where the angle is sharper than the given
+* angle or its sign differs from that of the current run.
+*
+* @param[in] polyline the open polyline
+* @param[in] angle the kink angle in degrees
+* @param[out] kinks the curvature indices (vertex index - 1) to split at
+***********************************************************************************************************************/
+static void findKinksAndDirectionChanges(const std::vector<cv::Point>& polyline, double angle, std::vector<int>& kinks)
+{
+    kinks.clear();
+    bool currentlyPositive = false;
+    for(int i = 1; i + 1 < static_cast<int>(polyline.size()); i++)
+    {
+        const cv::Point ab = polyline[i] - polyline[i - 1];
+        const cv::Point cb = polyline[i] - polyline[i + 1];
+        const double dot = static_cast<double>(ab.x) * cb.x + static_cast<double>(ab.y) * cb.y;
+        const double cross = static_cast<double>(ab.x) * cb.y - static_cast<double>(ab.y) * cb.x;
+        const double curvature = std::atan2(cross, dot) * 180.0 / CV_PI;
+
+        const bool positive = curvature > 0;
+        if(i == 1)
+        {
+            currentlyPositive = positive;
+        }
+        if(positive != currentlyPositive || std::abs(curvature) < angle)
+        {
+            currentlyPositive = positive;
+            kinks.push_back(i - 1);
+        }
+    }
+}
+
+/*******************************************************************************************************************//**
+* @brief Checks if an ellipse is a plausible pupil, as ellipse_filter in the pupil-labs detector
+*
+* The center must lie inside the pupil region by at least the candidate padding, the ellipse must be round enough and
+* its major axis must be within the pupil size range.
+*
+* @param[in] ellipse the candidate ellipse in pupil region coordinates
+* @param[in] roiSize the size of the pupil region
+* @return true if the ellipse passes
+***********************************************************************************************************************/
+bool PupilTracker::ellipseFilter(const cv::RotatedRect& ellipse, const cv::Size& roiSize) const
+{
+    const float padding = m_candidate_padding;
+    const bool inCenter = padding < ellipse.center.y && ellipse.center.y < roiSize.height - padding &&
+                          padding < ellipse.center.x && ellipse.center.x < roiSize.width - padding;
+    if(!inCenter)
+    {
+        return false;
+    }
+
+    const float major = std::max(ellipse.size.width, ellipse.size.height);
+    const float minor = std::min(ellipse.size.width, ellipse.size.height);
+    if(major <= 0 || minor / major < m_min_ratio)
+    {
+        return false;
+    }
+    return m_pupil_min <= major && major <= m_pupil_max;
+}
+
+/*******************************************************************************************************************//**
+* @brief Evaluates ellipse candidates on the pupil edges, as the pupil-labs canny detector does
+*
+* Ports the candidate evaluation of pupil_detectors/canny_detector.py: the strong prior from the last frame is tried
+* first, otherwise the edge contours are simplified and split at kinks, the segments that fit a plausible ellipse on
+* their own become seeds, and combinations of segments grown from the seeds are searched (pruning_quick_combine) and
+* rated by the edge pixels that support their ellipse. The best combination is refit to its supporting edge pixels.
+*
+* The segments and the paths of the combination search are kept in flat arrays that persist between frames, and the
+* seeds, each level of the combination search and the ratings are evaluated in parallel. The search order and
+* results match the sequential python version.
+*
+* @param[in] edges the pruned edge image of the pupil region
+* @param[out] ellipse the pupil ellipse in pupil region coordinates
+* @return true if a pupil ellipse was found
+***********************************************************************************************************************/
+bool PupilTracker::findEllipseCandidates(const cv::Mat& edges, cv::RotatedRect& ellipse)
+{
+    const cv::Size roiSize = edges.size();
+    const cv::Point2f roiOffset(static_cast<float>(m_pupilRoi.x), static_cast<float>(m_pupilRoi.y));
+
+    // get the raw edge pixels for the support measures
+    m_rawEdges.clear();
+    if(cv::countNonZero(edges) > 0)
+    {
+        cv::findNonZero(edges, m_rawEdges);
+    }
+
+    // if we had a good ellipse before, see if it is still a good first guess
+    if(m_has_strong_prior)
+    {
+        m_has_strong_prior = false;
+        cv::RotatedRect prior = m_strong_prior;
+        prior.center -= roiOffset;
+
+        m_supportPoints.clear();
+        const double supportRatio = ellipseTrueSupport(prior, m_rawEdges, &m_supportPoints) / ellipseCircumference(prior);
+        if(supportRatio >= m_strong_perimeter_ratio_range.x && m_supportPoints.size() >= 5)
+        {
+            ellipse = ellipse_fit::fitEllipse(m_supportPoints);
+            m_strong_prior = cv::RotatedRect(ellipse.center + roiOffset, ellipse.size, ellipse.angle);
+            m_has_strong_prior = true;
+            m_target_size = std::max(ellipse.size.width, ellipse.size.height);
+            m_confidence = ellipseConfidence(ellipse, m_rawEdges, m_fit_residual_sigma);
+            return true;
+        }
+    }
+
+    // from edges to contours (findContours modifies its input)
+    reuseBuffer(m_contourEdges, roiSize, CV_8UC1);
+    edges.copyTo(m_contourEdges);
+    cv::findContours(m_contourEdges, m_contours, CV_RETR_LIST, CV_CHAIN_APPROX_NONE);
+
+    // simplify the long contours and split them where they kink or change direction into the segment arena
+    m_segmentPoints.clear();
+    m_segments.clear();
+    for(size_t c = 0; c < m_contours.size(); c++)
+    {
+        if(static_cast<int>(m_contours[c].size()) <= m_min_edge_contour_size)
+        {
+            continue;
+        }
+        cv::approxPolyDP(m_contours[c], m_approx, 1.5, false);
+        findKinksAndDirectionChanges(m_approx, 80, m_kinks);
+
+        // each segment runs from one split vertex to the next, inclusive
+        const int count = static_cast<int>(m_approx.size());
+        int start = 0;
+        for(size_t k = 0; k <= m_kinks.size(); k++)
+        {
+            const int end = (k < m_kinks.size()) ? std::min(m_kinks[k] + 1, count - 1) : count - 1;
+            // removing stubs makes the combinatorial search feasible
+            if(end - start + 1 > 3)
+            {
+                const int begin = static_cast<int>(m_segmentPoints.size());
+                m_segmentPoints.insert(m_segmentPoints.end(), m_approx.begin() + start, m_approx.begin() + end + 1);
+                m_segments.push_back(cv::Range(begin, static_cast<int>(m_segmentPoints.size())));
+            }
+            start = (k < m_kinks.size()) ? m_kinks[k] + 1 : count;
+        }
+    }
+
+    // longest segments first (ties keep their contour order, as a stable sort would, without its temporary buffer)
+    std::sort(m_segments.begin(), m_segments.end(), [](const cv::Range& a, const cv::Range& b) {
+        return a.size() > b.size() || (a.size() == b.size() && a.start < b.start);
+    });
+    if(m_segments.empty())
+    {
+        return false;
+    }
+
+    // find the segments that describe a plausible pupil ellipse on their own (0 none, 1 weak seed, 2 strong seed)
+    // (every segment has its own hull storage, which is never shrunk, so the tasks reuse it on the next frame)
+    const int segmentCount = static_cast<int>(m_segments.size());
+    m_seedStrength.assign(segmentCount, 0);
+    if(static_cast<int>(m_hulls.size()) < segmentCount)
+    {
+        m_hulls.resize(segmentCount);
+    }
+    cv::parallel_for_(cv::Range(0, segmentCount), parallelIndexLoop([&](int i) {
+        const cv::Point* points = &m_segmentPoints[m_segments[i].start];
+        const int count = m_segments[i].size();
+        if(count < 5)
+        {
+            return;
+        }
+        const cv::Mat segment(1, count, CV_32SC2, const_cast<cv::Point*>(points));
+        const cv::RotatedRect e = ellipse_fit::fitEllipse(points, count);
+        if(!ellipseFilter(e, roiSize) || ellipseFitVariance(e, points, count) > m_inital_ellipse_fit_threshhold)
+        {
+            return;
+        }
+
+        // how much of the ellipse is supported by this segment
+        const double a = e.size.width / 2.0;
+        const double b = e.size.height / 2.0;
+        std::vector<cv::Point>& hull = m_hulls[i];
+        cv::convexHull(segment, hull);
+        const double areaRatio = cv::contourArea(hull) / (CV_PI * a * b);
+        const double perimeterRatio = cv::arcLength(segment, false) / ellipseCircumference(e);
+        const bool strong = m_strong_perimeter_ratio_range.x <= perimeterRatio && perimeterRatio <= m_strong_perimeter_ratio_range.y &&
+                            m_strong_area_ratio_range.x <= areaRatio && areaRatio <= m_strong_area_ratio_range.y;
+        m_seedStrength[i] = strong ? 2 : 1;
+    }));
+
+    // seed from the strong segments if there are any, otherwise from the weak ones
+    const int seedLevel = std::count(m_seedStrength.begin(), m_seedStrength.end(), 2) > 0 ? 2 : 1;
+    m_mapping.clear();
+    for(int i = 0; i < segmentCount; i++)
+    {
+        if(m_seedStrength[i] == seedLevel)
+        {
+            m_mapping.push_back(i);
+        }
+    }
+    const int seedCount = static_cast<int>(m_mapping.size());
+    if(seedCount == 0)
+    {
+        return false;
+    }
+    for(int i = 0; i < segmentCount; i++)
+    {
+        if(m_seedStrength[i] != seedLevel)
+        {
+            m_mapping.push_back(i);
+        }
+    }
+
+    // gathers the points of the segments on a path of positions in the mapping
+    auto gatherSegments = [&](const std::vector<int>& positions, const cv::Range& path, std::vector<cv::Point>& points) {
+        points.clear();
+        for(int i = path.start; i < path.end; i++)
+        {
+            const cv::Range& segment = m_segments[m_mapping[positions[i]]];
+            points.insert(points.end(), m_segmentPoints.begin() + segment.start, m_segmentPoints.begin() + segment.end);
+        }
+    };
+
+    // appends a path, optionally extended by one more position, to a flat path list
+    auto appendPath = [](std::vector<int>& positions, std::vector<cv::Range>& paths, const int* path, int count, int next) {
+        const int begin = static_cast<int>(positions.size());
+        positions.insert(positions.end(), path, path + count);
+        if(next >= 0)
+        {
+            positions.push_back(next);
+        }
+        paths.push_back(cv::Range(begin, static_cast<int>(positions.size())));
+    };
+
+    // breadth first search over the combinations grown from the seeds, pruning every superset of a failed combination
+    // (paths hold positions in the mapping and only grow by later positions, so each level can be evaluated at once and
+    // every path is sorted; like the segments, the paths are ranges into flat position lists)
+    m_frontierPositions.clear();
+    m_frontier.clear();
+    m_prunedPositions.clear();
+    m_pruned.clear();
+    m_solutionPositions.clear();
+    m_solutions.clear();
+    for(int i = 0; i < seedCount; i++)
+    {
+        appendPath(m_frontierPositions, m_frontier, &i, 1, -1);
+    }
+    int evaluationsLeft = m_max_combine_evals;
+    while(!m_frontier.empty() && evaluationsLeft > 0)
+    {
+        const int levelCount = std::min(static_cast<int>(m_frontier.size()), evaluationsLeft);
+        evaluationsLeft -= levelCount;
+
+        m_evaluate.assign(levelCount, 0);
+        m_passed.assign(levelCount, 0);
+        for(int i = 0; i < levelCount; i++)
+        {
+            const cv::Range& path = m_frontier[i];
+            if(path.size() > m_max_combine_depth)
+            {
+                continue;
+            }
+            const int* positions = m_frontierPositions.data() + path.start;
+            bool isPruned = false;
+            for(size_t p = 0; p < m_pruned.size() && !isPruned; p++)
+            {
+                const int* pruned = m_prunedPositions.data() + m_pruned[p].start;
+                isPruned = std::includes(positions, positions + path.size(), pruned, pruned + m_pruned[p].size());
+            }
+            m_evaluate[i] = !isPruned;
+        }
 
+        // every task gathers into its own point list, which is never shrunk
+        if(static_cast<int>(m_taskPoints.size()) < levelCount)
+        {
+            m_taskPoints.resize(levelCount);
+        }
+        cv::parallel_for_(cv::Range(0, levelCount), parallelIndexLoop([&](int i) {
+            if(!m_evaluate[i])
+            {
+                return;
+            }
+            std::vector<cv::Point>& points = m_taskPoints[i];
+            gatherSegments(m_frontierPositions, m_frontier[i], points);
+            const cv::RotatedRect e = ellipse_fit::fitEllipse(points);
+            m_passed[i] = ellipseFitVariance(e, &points[0], static_cast<int>(points.size())) <= m_inital_ellipse_fit_threshhold;
+        }));
+
+        m_nextFrontierPositions.clear();
+        m_nextFrontier.clear();
+        for(int i = 0; i < levelCount; i++)
+        {
+            if(!m_evaluate[i])
+            {
+                continue;
+            }
+            const int* path = m_frontierPositions.data() + m_frontier[i].start;
+            const int pathLength = m_frontier[i].size();
+            if(m_passed[i])
+            {
+                appendPath(m_solutionPositions, m_solutions, path, pathLength, -1);
+                for(int next = path[pathLength - 1] + 1; next < static_cast<int>(m_mapping.size()); next++)
+                {
+                    appendPath(m_nextFrontierPositions, m_nextFrontier, path, pathLength, next);
+                }
+            }
+            else
+            {
+                appendPath(m_prunedPositions, m_pruned, path, pathLength, -1);
+            }
+        }
+        m_frontier.swap(m_nextFrontier);
+        m_frontierPositions.swap(m_nextFrontierPositions);
+    }
+
+    // drop the solutions that are contained in another solution (the mapping is one to one, so comparing the sorted
+    // positions is the same as comparing the segments)
+    m_candidates.clear();
+    for(size_t i = 0; i < m_solutions.size(); i++)
+    {
+        const int* solution = m_solutionPositions.data() + m_solutions[i].start;
+        bool isSubset = false;
+        for(size_t j = 0; j < m_solutions.size() && !isSubset; j++)
+        {
+            const int* other = m_solutionPositions.data() + m_solutions[j].start;
+            isSubset = (i != j) && std::includes(other, other + m_solutions[j].size(), solution, solution + m_solutions[i].size());
+        }
+        if(!isSubset)
+        {
+            m_candidates.push_back(static_cast<int>(i));
+        }
+    }
+    if(m_candidates.empty())
+    {
+        return false;
+    }
+
+    // rate every candidate by the edge pixels supporting its ellipse
+    const int candidateCount = static_cast<int>(m_candidates.size());
+    m_candidateEllipses.resize(candidateCount);
+    m_supportRatios.assign(candidateCount, 0.0);
+    m_ratings.assign(candidateCount, -1);
+    if(static_cast<int>(m_taskPoints.size()) < candidateCount)
+    {
+        m_taskPoints.resize(candidateCount);
+    }
+    cv::parallel_for_(cv::Range(0, candidateCount), parallelIndexLoop([&](int i) {
+        std::vector<cv::Point>& points = m_taskPoints[i];
+        gatherSegments(m_solutionPositions, m_solutions[m_candidates[i]], points);
+        const cv::RotatedRect e = ellipse_fit::fitEllipse(points);
+        const int support = ellipseTrueSupport(e, m_rawEdges, NULL);
+        m_candidateEllipses[i] = e;
+        m_supportRatios[i] = support / ellipseCircumference(e);
+        if(m_supportRatios[i] >= m_final_perimeter_ratio_range.x && ellipseFilter(e, roiSize))
+        {
+            m_ratings[i] = support;
+        }
+    }));
+
+    // remember the last strongly supported candidate as the prior for the next frame
+    int best = 0;
+    for(int i = 0; i < candidateCount; i++)
+    {
+        if(m_ratings[i] > m_ratings[best])
+        {
+            best = i;
+        }
+        if(m_ratings[i] >= 0 && m_supportRatios[i] >= m_strong_perimeter_ratio_range.x)
+        {
+            const cv::RotatedRect& e = m_candidateEllipses[i];
+            m_strong_prior = cv::RotatedRect(e.center + roiOffset, e.size, e.angle);
+            m_has_strong_prior = true;
+        }
+    }
+    if(m_ratings[best] < 0)
+    {
+        return false;
+    }
+    ellipse = m_candidateEllipses[best];
+
+    // final fitting, using the real edge pixels near the best segments rather than the simplified segments
+    reuseBuffer(m_supportMask, roiSize, CV_8UC1);
+    m_supportMask.setTo(0);
+    const cv::Range& bestPath = m_solutions[m_candidates[best]];
+    for(int i = bestPath.start; i < bestPath.end; i++)
+    {
+        const cv::Range& segment = m_segments[m_mapping[m_solutionPositions[i]]];
+        const cv::Point* points = &m_segmentPoints[segment.start];
+        const int count = segment.size();
+        cv::polylines(m_supportMask, &points, &count, 1, false, cv::Scalar(255), 2);
+    }
+    cv::min(edges, m_supportMask, m_supportMask);
+    if(cv::countNonZero(m_supportMask) >= 5)
+    {
+        cv::findNonZero(m_supportMask, m_finalEdges);
+        const cv::RotatedRect finalEllipse = ellipse_fit::fitEllipse(m_finalEdges);
+        const float finalMajor = std::max(finalEllipse.size.width, finalEllipse.size.height);
+        const double sizeDifference = std::abs(1 - std::max(ellipse.size.width, ellipse.size.height) / finalMajor);
+        if(ellipseFilter(finalEllipse, roiSize) && sizeDifference < 0.3)
+        {
+            ellipse = finalEllipse;
+        }
+    }
+
+    m_target_size = std::max(ellipse.size.width, ellipse.size.height);
+    m_confidence = ellipseConfidence(ellipse, m_rawEdges, m_fit_residual_sigma);
+    return true;
+}
+
+/*******************************************************************************************************************//**
+* @brief This method utilizes moments to calculate the center of mass of the merged pupil contours
+*
+* The moments are computed from the contour geometry rather than from a rasterised mask. By default every contour
+* point is counted once, so the ellipse is fit to the pupil boundary. When m_fillContours is set, the moments of the
+* areas enclosed by the contours are used instead, computed with Green's theorem over each contour polygon.
+*
+* @param[in] contours the merged pupil contours
+* @param[out] ellipse the ellipse of the moments
+* @return false if the moments are empty (no contour points, or no enclosed area)
+* @author Krishna Bhattarai
+***********************************************************************************************************************/
+bool PupilTracker::getEllipseCentroid(const std::vector<std::vector<cv::Point> > &contours, cv::RotatedRect &ellipse)
+{
+    //Even though it says centroid right now it is trying to return stuff needed for the
+    // rotated rectangle.
+
+    double m00 = 0, m10 = 0, m01 = 0, m20 = 0, m11 = 0, m02 = 0;
+    for(size_t c = 0; c < contours.size(); c++)
+    {
+        const Contour_2D& contour = contours[c];
+        if(!m_fillContours)
+        {
+            // sum the boundary points
+            m00 += static_cast<double>(contour.size());
+            for(size_t i = 0; i < contour.size(); i++)
+            {
+                const double x = contour[i].x;
+                const double y = contour[i].y;
+                m10 += x;
+                m01 += y;
+                m20 += x * x;
+                m11 += x * y;
+                m02 += y * y;
+            }
+        }
+        else
+        {
+            // integrate over the enclosed area as a line integral around the closed polygon (Green's theorem)
+            double a00 = 0, a10 = 0, a01 = 0, a20 = 0, a11 = 0, a02 = 0;
+            for(size_t i = 0, j = contour.size() - 1; i < contour.size(); j = i++)
+            {
+                const double x0 = contour[j].x, y0 = contour[j].y;
+                const double x1 = contour[i].x, y1 = contour[i].y;
+                const double cross = x0 * y1 - x1 * y0;
+                a00 += cross;
+                a10 += cross * (x0 + x1);
+                a01 += cross * (y0 + y1);
+                a20 += cross * (x0 * x0 + x0 * x1 + x1 * x1);
+                a11 += cross * (2 * x0 * y0 + x0 * y1 + x1 * y0 + 2 * x1 * y1);
+                a02 += cross * (y0 * y0 + y0 * y1 + y1 * y1);
+            }
+
+            // the contour orientation only flips the sign, so every contour adds its area
+            const double sign = a00 < 0 ? -1.0 : 1.0;
+            m00 += sign * a00 / 2;
+            m10 += sign * a10 / 6;
+            m01 += sign * a01 / 6;
+            m20 += sign * a20 / 12;
+            m11 += sign * a11 / 24;
+            m02 += sign * a02 / 12;
+        }
+    }
+
+    return getEllipseFromMoments(cv::Moments(m00, m10, m01, m20, m11, m02, 0, 0, 0, 0), ellipse);
+}
+
+/*******************************************************************************************************************//**
+* @brief Calculates the center, axes and angle of the ellipse with the given spatial moments
+* @param[in] m the spatial moments up to second order
+* @param[out] ret the ellipse of the moments, unchanged when they are empty
+* @return false if the moments are empty
+***********************************************************************************************************************/
+bool PupilTracker::getEllipseFromMoments(const cv::Moments &m, cv::RotatedRect &ret)
+{
     // The crash occurs when the values change to 0/0 for center, box.width, and box.height
-    if (!m_display)
+    if (!ellipse_fit::fitEllipse(m, ret))
+    {
+        return false;
+    }
+    ret.size.width += 5;
+    ret.size.height += 5;
+
+    if (m_display)
     {
         std::cout << "center x: " << ret.center.x << " center y: " << ret.center.y << std::endl;
         std::cout << "box.width: " << ret.size.width << " box.height: " << ret.size.height << std::endl;
         std::cout << "rect.angle: " << ret.angle << "\n" << std::endl;
     }
-    return ret;
+    return true;
 }
 
 
@@ -285,6 +1238,22 @@ cv::RotatedRect PupilTracker::getEllipseRectangle()
     return m_ellipseRectangle;
 }
 
+/*******************************************************************************************************************//**
+* @brief Gets the region of the last frame that the pupil was searched in
+***********************************************************************************************************************/
+cv::Rect PupilTracker::getPupilRoi()
+{
+    return m_pupilRoi;
+}
+
+/*******************************************************************************************************************//**
+* @brief Gets the confidence of the last pupil ellipse, from its edge support and fit residual
+***********************************************************************************************************************/
+float PupilTracker::getConfidence()
+{
+    return m_confidence;
+}
+
 /*******************************************************************************************************************//**
 * @brief Sets the display mode for the pupil tracker
 * @author Christopher D. McMurrough
@@ -295,6 +1264,15 @@ void PupilTracker::setDisplay(bool display)
     m_display = display;
 }
 
+/*******************************************************************************************************************//**
+* @brief Sets whether the fallback moments are taken over the areas enclosed by the dark region contours, rather than
+* over the contour points (see getEllipseCentroid)
+***********************************************************************************************************************/
+void PupilTracker::setFillContours(bool fillContours)
+{
+    m_fillContours = fillContours;
+}
+
 /*******************************************************************************************************************//**
 * @brief Calculates the histogram spikes and sets those values using their address
 * @author Christopher D. McMurrough
@@ -351,91 +1329,17 @@ inline cv::Rect boundingBox(const cv::Mat& img)
 * @brief This is what gets us the region of interest. Even though the parameter has something called roi, it is just an 
   empty container to hold the roi that we are going to compute. Later on we will overlay this roi with whatever image we want.
   Get the ROI where the boarder of black pixels is removed. This was an adaption from the pupil laps eye tracking code
+*
+* Uses cvx::nonZeroBounds from the Swirski tracker, which finds the x and y ranges in one vectorised row-major pass.
 * @author Krishna Bhattarai
 ***********************************************************************************************************************/
 bool PupilTracker::getRoiWithoutBorder(const cv::Mat& img , cv::Rect& roi)
 {
-
     CV_Assert(img.depth() == CV_8U);
-    CV_Assert(img.isContinuous());
 
     if (img.total() == 0) return  false;
 
-    int n_rows = img.rows, n_cols = img.cols;
-    int x_min = 0, y_min = 0;
-    int x_max = n_cols - 1, y_max = n_rows - 1;
-
-    const uchar* img_ptr = img.data;
-    bool found = false;
-    bool break_loop = false;
-
-    // find the roi where all pixles outside are zero
-    // instead of iterating through the whole image
-    // we try each side and find the first none zero point
-
-    //from top, find the y where the first non-zero pixel occures in a row
-    for (int i = 0; i < n_rows * n_cols; i++) {
-        if (*img_ptr != 0) {
-            int row = int(i / n_cols);
-            y_min = row;
-            found = true;
-            break;
-        }
-
-        img_ptr++;
-    } // end loop
-
-    if (found == false) return  false; // we can stop here, nothing found
-
-    // from bottom, find the y where the first non-zero pixel occures in a row
-    img_ptr = &img.data[n_rows * n_cols - 1];
-
-    for (int i = n_rows * n_cols - 1; i >= 0; i--) {
-        if (*img_ptr != 0) {
-            int row = int(i / n_cols);
-            y_max = row;
-            break;
-        }
-
-        img_ptr--;
-    } // end loop
-
-    // from left, find the x where the first non-zero pixel occures in a column
-    // ignore y values lower or higher the one we already found
-    for (int i = 0; i < n_cols; i++) {
-        for (int j = y_min; j <= y_max; j++) {
-            img_ptr = &img.data[i +  j * n_cols];
-
-            if (*img_ptr != 0) {
-                x_min = i;
-                break_loop = true;
-            }
-        }
-
-        if (break_loop) break;
-
-    } // end loop
-
-    break_loop = false;
-
-    // // from right, find the x where the first non-zero pixel occures in a column
-    // ignore y values lower or higher the one we already found
-    for (int i = n_cols - 1; i >= 0 ; i--) {
-        for (int j = y_min; j <= y_max; j++) {
-            img_ptr = &img.data[i +  j * n_cols];
-
-            if (*img_ptr != 0) {
-                x_max = i;
-                break_loop = true;
-            }
-        }
-
-        if (break_loop) break;
-
-    } // end loop
-
-    roi =  cv::Rect(x_min, y_min, 1 + (x_max-x_min) , 1 + (y_max-y_min ) );
-    return true;
+    return cvx::nonZeroBounds(img, roi);
 }
 
 
@@ -10,9 +10,11 @@
 #ifndef PUPIL_TRACKER_H
 #define PUPIL_TRACKER_H
 
+#include <vector>
 #include <opencv2/core/core.hpp>
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/highgui/highgui.hpp"
+#include "cvx.h"
 /**********************************************************************************************************************
 * @class PupilTracker
 *
@@ -51,6 +53,7 @@ private:
     int m_glintIntensityOffset;
 
     int m_min_contour_size;
+    bool m_fillContours;
 
     float m_inital_ellipse_fit_threshhold;
     float m_min_ratio;
@@ -60,10 +63,82 @@ private:
     cv::Point2f m_strong_perimeter_ratio_range;
     cv::Point2f m_strong_area_ratio_range;
     cv::Point2f m_final_perimeter_ratio_range;
-    float m_strong_prior;
+    bool m_has_strong_prior;
+    cv::RotatedRect m_strong_prior;
 
     float m_confidence;
 
+    // define ellipse candidate evaluation variables
+    int m_min_edge_contour_size;
+    int m_max_combine_evals;
+    int m_max_combine_depth;
+    float m_candidate_padding;
+    float m_fit_residual_sigma;
+
+    // define temporal tracking variables
+    bool m_tracking;
+    float m_tracking_confidence;
+    float m_tracking_window_scale;
+
+    // flat storage of the split edge contour segments, and the edge pixels of the current frame
+    std::vector<cv::Point> m_segmentPoints;
+    std::vector<cv::Range> m_segments;
+    std::vector<cv::Point> m_rawEdges;
+
+    // storage for the luma plane of packed 4:2:2 and BGR camera buffers (see cvx::lumaPlane)
+    cv::Mat m_lumaBuffer;
+
+    // storage for the luma plane of colour input
+    cv::Mat m_lumaImage;
+
+    // coarse detection results and storage
+    cv::Rect m_pupilRoi;
+    cv::Mat m_coarseIntegral;
+
+    // structuring elements for the mask and eyelash filters
+    cv::Mat m_morphKernel;
+    cv::Mat m_openKernel;
+
+    // per frame images and point lists, kept between frames so that tracking does not reallocate them
+    cv::Mat m_imageGray;
+    cv::Mat m_histogram;
+    cv::Mat m_darkMask;
+    cv::Mat m_glintMask;
+    cv::Mat m_imageEyeLash;
+    cv::Mat m_imageBlurred;
+    cv::Mat m_edges;
+    cv::Mat m_edgesPruned;
+    cv::Mat m_contourEdges;
+    cv::Mat m_supportMask;
+    std::vector<std::vector<cv::Point> > m_contours;
+    std::vector<std::vector<cv::Point> > m_darkContours;
+    std::vector<std::vector<cv::Point> > m_connectedEdges;
+    std::vector<cv::Point> m_approx;
+    std::vector<int> m_kinks;
+    std::vector<cv::Point> m_supportPoints;
+    std::vector<cv::Point> m_finalEdges;
+
+    // workspaces of the ellipse candidate search; the paths are ranges into the position lists, and the per segment
+    // hulls and per task point lists are only ever grown, so the parallel tasks keep their storage between frames
+    std::vector<int> m_seedStrength;
+    std::vector<int> m_mapping;
+    std::vector<int> m_frontierPositions;
+    std::vector<cv::Range> m_frontier;
+    std::vector<int> m_nextFrontierPositions;
+    std::vector<cv::Range> m_nextFrontier;
+    std::vector<int> m_prunedPositions;
+    std::vector<cv::Range> m_pruned;
+    std::vector<int> m_solutionPositions;
+    std::vector<cv::Range> m_solutions;
+    std::vector<int> m_candidates;
+    std::vector<char> m_evaluate;
+    std::vector<char> m_passed;
+    std::vector<cv::RotatedRect> m_candidateEllipses;
+    std::vector<double> m_supportRatios;
+    std::vector<int> m_ratings;
+    std::vector<std::vector<cv::Point> > m_hulls;
+    std::vector<std::vector<cv::Point> > m_taskPoints;
+
     // debug settings
     bool m_display;
 
@@ -73,15 +148,27 @@ public:
     PupilTracker();
 
     // accessors
-    cv::RotatedRect getEllipseCentroid(const cv::Mat &test);
+    bool getEllipseCentroid(const std::vector<std::vector<cv::Point> > &contours, cv::RotatedRect &ellipse);
+    bool getEllipseFromMoments(const cv::Moments &m, cv::RotatedRect &ellipse);
 
     cv::RotatedRect getEllipseRectangle();
 
+    cv::Rect getPupilRoi();
+
+    float getConfidence();
+
 
     // utility functions
     bool findPupil(const cv::Mat &imageIn);
+    bool findPupil(const uchar* data, int width, int height, size_t step, cvx::PixelFormat format);
+    bool detectPupil(const cv::Mat &imageIn, bool useTrackingWindow);
+
+    bool findCoarsePupilRoi(const cv::Mat &imageGray, cv::Rect &roi);
+    bool findEllipseCandidates(const cv::Mat &edges, cv::RotatedRect &ellipse);
+    bool ellipseFilter(const cv::RotatedRect &ellipse, const cv::Size &roiSize) const;
 
     void setDisplay(bool display);
+    void setFillContours(bool fillContours);
 
     void draw_dotted_rect(cv::Mat &image, const cv::Rect &rect, const cv::Scalar &color);
     void calculate_spike_indices_and_max_intenesity(cv::Mat& histogram,
@@ -0,0 +1,87 @@
+/*******************************************************************************************************************//**
+* @file SwirskiTracker.cpp
+* @brief Implementation of the SwirskiTracker class
+*
+* This class wraps the robust (Haar, k-means and RANSAC) pupil tracker by Lech Swirski
+***********************************************************************************************************************/
+
+#include "SwirskiTracker.h"
+#include "swirski_pupil/PupilTracker.h"
+
+// define the robust tracking parameters (as used by the standalone robust tracker)
+#define MIN_RADIUS 10
+#define MAX_RADIUS 60
+#define CANNY_BLUR 1.6
+#define CANNY_THRESH_1 30
+#define CANNY_THRESH_2 50
+#define STARBURST_POINTS 0
+#define PERCENT_INLIERS 40
+#define INLIER_ITERATIONS 2
+#define IMAGE_AWARE_SUPPORT true
+#define EARLY_TERMINATION_PERCENTAGE 95
+#define EARLY_REJECTION true
+#define SEED_VALUE -1
+#define ELLIPSE_FITTER PupilTracker::FITTER_RANSAC
+
+struct SwirskiTracker::Params : public PupilTracker::TrackerParams
+{
+};
+
+/*******************************************************************************************************************//**
+* @brief Constructor to create a SwirskiTracker
+***********************************************************************************************************************/
+SwirskiTracker::SwirskiTracker()
+{
+    m_params = new Params();
+    m_params->Radius_Min = MIN_RADIUS;
+    m_params->Radius_Max = MAX_RADIUS;
+    m_params->CannyBlur = CANNY_BLUR;
+    m_params->CannyThreshold1 = CANNY_THRESH_1;
+    m_params->CannyThreshold2 = CANNY_THRESH_2;
+    m_params->StarburstPoints = STARBURST_POINTS;
+    m_params->PercentageInliers = PERCENT_INLIERS;
+    m_params->InlierIterations = INLIER_ITERATIONS;
+    m_params->ImageAwareSupport = IMAGE_AWARE_SUPPORT;
+    m_params->EarlyTerminationPercentage = EARLY_TERMINATION_PERCENTAGE;
+    m_params->EarlyRejection = EARLY_REJECTION;
+    m_params->Seed = SEED_VALUE;
+    m_params->Fitter = ELLIPSE_FITTER;
+}
+
+/*******************************************************************************************************************//**
+* @brief Destructor for the SwirskiTracker class
+***********************************************************************************************************************/
+SwirskiTracker::~SwirskiTracker()
+{
+    delete m_params;
+}
+
+/*******************************************************************************************************************//**
+* @brief Attempt to fit a pupil ellipse in the eye image frame
+*
+* A valid seed ellipse replaces the Haar search for the pupil region, an empty seed (zero size) searches the whole image
+*
+* @param[in] imageIn the input OpenCV image
+* @param[in] seed the pupil estimate of a cheaper tracker, or an empty rectangle
+* @return true if the a pupil was located in the image
+***********************************************************************************************************************/
+bool SwirskiTracker::findPupil(const cv::Mat& imageIn, const cv::RotatedRect& seed)
+{
+    PupilTracker::findPupilEllipse_out out;
+    tracker_log log;
+    if(PupilTracker::findPupilEllipse(*m_params, imageIn, seed, out, log))
+    {
+        m_ellipseRectangle = out.elPupil;
+        return true;
+    }
+    return false;
+}
+
+/*******************************************************************************************************************//**
+* @brief Gets the ellipse rectangle of the most recently tracked pupil
+* @return the pupil ellipse in image coordinates
+***********************************************************************************************************************/
+cv::RotatedRect SwirskiTracker::getEllipseRectangle()
+{
+    return m_ellipseRectangle;
+}
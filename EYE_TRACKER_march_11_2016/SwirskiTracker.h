@@ -0,0 +1,49 @@
+/**********************************************************************************************************************
+* @file SwirskiTracker.h
+* @brief Header for the SwirskiTracker class
+*
+* This class wraps the robust (Haar, k-means and RANSAC) pupil tracker by Lech Swirski. The robust tracker is declared
+* in the PupilTracker namespace, which clashes with the PupilTracker class, so its header is only included by
+* SwirskiTracker.cpp
+***********************************************************************************************************************/
+
+#ifndef SWIRSKI_TRACKER_H
+#define SWIRSKI_TRACKER_H
+
+#include <opencv2/core/core.hpp>
+
+/**********************************************************************************************************************
+* @class SwirskiTracker
+*
+* @brief Class for tracking pupils in an occulography image using the robust pupil tracker
+*
+* The robust tracker by Lech Swirski
+* http://www.cl.cam.ac.uk/research/rainbow/projects/pupiltracking/
+***********************************************************************************************************************/
+class SwirskiTracker {
+private:
+
+    // the robust tracker parameters, defined in SwirskiTracker.cpp
+    struct Params;
+    Params* m_params;
+
+    // define tracking result parameters
+    cv::RotatedRect m_ellipseRectangle;
+
+    // the parameter storage is owned, so disable copying
+    SwirskiTracker(const SwirskiTracker&);
+    SwirskiTracker& operator=(const SwirskiTracker&);
+
+public:
+
+    // constructors
+    SwirskiTracker();
+    ~SwirskiTracker();
+
+    // accessors
+    cv::RotatedRect getEllipseRectangle();
+
+    // utility functions
+    bool findPupil(const cv::Mat &imageIn, const cv::RotatedRect &seed);
+};
+#endif // SWIRSKI_TRACKER_H
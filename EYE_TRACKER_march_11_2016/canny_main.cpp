@@ -17,6 +17,9 @@
 #include <stdlib.h>
 #include <string>
 #include "PupilTracker.h"
+#ifdef CASCADE_TRACKER
+#include "CascadeTracker.h"
+#endif
 
 // configuration parameters
 #define NUM_COMNMAND_LINE_ARGUMENTS 2
@@ -33,6 +36,9 @@
 #define CAMERA_EXPOSURE -60
 #define CAMERA_CONVERT_RGB false
 
+// number of frames between cascade statistics reports
+#define STATISTICS_FRAMES 300
+
 // color constants
 CvScalar COLOR_WHITE = CV_RGB(255, 255, 255);
 CvScalar COLOR_RED = CV_RGB(255, 0, 0);
@@ -127,7 +133,12 @@ int main(int argc, char** argv)
     }
 
     // create the pupil tracking object
+#ifdef CASCADE_TRACKER
+    CascadeTracker tracker;
+    int statisticsFrames = 0;
+#else
     PupilTracker tracker;
+#endif
     tracker.setDisplay(displayMode);
 
     // store the frame data
@@ -155,6 +166,16 @@ int main(int argc, char** argv)
             processEndTicks = clock();
             processTime = ((float)(processEndTicks - processStartTicks)) / CLOCKS_PER_SEC;
 
+#ifdef CASCADE_TRACKER
+            // report the cascade hit rate
+            if(++statisticsFrames == STATISTICS_FRAMES)
+            {
+                tracker.printStatistics();
+                tracker.resetStatistics();
+                statisticsFrames = 0;
+            }
+#endif
+
             // warn on tracking failure
             if(!trackingSuccess)
             {
@@ -277,6 +298,10 @@ int main(int argc, char** argv)
        
     }
 
+#ifdef CASCADE_TRACKER
+    tracker.printStatistics();
+#endif
+
     // release the video source before exiting
     occulography.release();
 }
@@ -0,0 +1,318 @@
+/*******************************************************************************************************************//**
+ * @file test_allocations.cpp
+ * @brief Regression test for the heap traffic of the canny pupil tracker
+ *
+ * Runs the tracker over synthetic eye frames with a counting cv::MatAllocator installed as the default allocator and a
+ * counting global operator new. Once the member buffers have grown to the frame, no image buffer and no heap block
+ * allocated during a frame may outlive it, so a member that is reallocated in the steady state is caught whichever
+ * library allocated it. Temporaries that OpenCV allocates and frees inside a call are allowed, while the tracker's own
+ * code (identified by dladdr as this executable) must not allocate at all.
+ **********************************************************************************************************************/
+
+#include <iostream>
+#include <new>
+#include <stdlib.h>
+#include <dlfcn.h>
+#include <atomic>
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include "PupilTracker.h"
+
+// number of passes over a sequence to grow the buffers, and number of frames to check for allocations
+#define WARMUP_CYCLES 5
+#define TEST_FRAMES 100
+
+// synthetic frame parameters
+#define FRAME_WIDTH 320
+#define FRAME_HEIGHT 240
+#define PUPIL_OFFSET 60
+#define MOVING_FRAMES 8
+
+#if CV_VERSION_MAJOR >= 4
+typedef cv::AccessFlag AccessFlags;
+#else
+typedef int AccessFlags;
+#endif
+
+// serial of the frame being checked, or 0 outside of the checks
+static std::atomic<long> g_frame(0);
+static long g_lastFrame = 0;
+
+// heap blocks and image buffers allocated during a frame and not freed by the end of it
+static std::atomic<long> g_retainedBlocks(0);
+static std::atomic<long> g_retainedBuffers(0);
+
+// allocations requested by code in this executable during a frame
+static std::atomic<long> g_trackerAllocations(0);
+
+// every heap block is prefixed with the serial of the frame that allocated it (16 bytes to keep the alignment)
+#define BLOCK_HEADER 16
+
+/*******************************************************************************************************************//**
+ * @brief Counts an allocation if it was requested from this executable rather than from a shared library
+ **********************************************************************************************************************/
+static void countTrackerAllocation(const void* caller)
+{
+    static Dl_info executable;
+    static const bool executableFound = dladdr(reinterpret_cast<void*>(&countTrackerAllocation), &executable) != 0;
+    Dl_info info;
+    if(!executableFound || (dladdr(caller, &info) != 0 && info.dli_fbase == executable.dli_fbase))
+    {
+        g_trackerAllocations++;
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief Allocates a heap block stamped with the current frame
+ **********************************************************************************************************************/
+static void* allocateBlock(std::size_t size, const void* caller)
+{
+    char* block = static_cast<char*>(malloc(size + BLOCK_HEADER));
+    if(block == NULL)
+    {
+        return NULL;
+    }
+    const long frame = g_frame;
+    *reinterpret_cast<long*>(block) = frame;
+    if(frame > 0)
+    {
+        g_retainedBlocks++;
+        countTrackerAllocation(caller);
+    }
+    return block + BLOCK_HEADER;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Frees a heap block, which is no longer retained if it was allocated during the current frame
+ **********************************************************************************************************************/
+static void freeBlock(void* pointer)
+{
+    if(pointer == NULL)
+    {
+        return;
+    }
+    char* block = static_cast<char*>(pointer) - BLOCK_HEADER;
+    const long frame = *reinterpret_cast<long*>(block);
+    if(frame > 0 && frame == g_frame)
+    {
+        g_retainedBlocks--;
+    }
+    free(block);
+}
+
+void* operator new(std::size_t size)
+{
+    void* pointer = allocateBlock(size, __builtin_return_address(0));
+    if(pointer == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void* operator new[](std::size_t size)
+{
+    void* pointer = allocateBlock(size, __builtin_return_address(0));
+    if(pointer == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return allocateBlock(size, __builtin_return_address(0));
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return allocateBlock(size, __builtin_return_address(0));
+}
+
+void operator delete(void* pointer) noexcept
+{
+    freeBlock(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    freeBlock(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept
+{
+    freeBlock(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept
+{
+    freeBlock(pointer);
+}
+
+/*******************************************************************************************************************//**
+ * @brief Image buffer data stamped with the frame that allocated it
+ **********************************************************************************************************************/
+struct CountedData : public cv::UMatData
+{
+    CountedData(const cv::MatAllocator* allocator) : cv::UMatData(allocator), frame(g_frame) {}
+    long frame;
+};
+
+/*******************************************************************************************************************//**
+ * @brief Mat allocator that counts the image buffers outliving the frame that allocated them
+ *
+ * Allocates like the standard OpenCV allocator (cv::fastMalloc, or the user data if there is any).
+ **********************************************************************************************************************/
+class CountingAllocator : public cv::MatAllocator
+{
+public:
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, AccessFlags, cv::UMatUsageFlags) const
+    {
+        size_t total = CV_ELEM_SIZE(type);
+        for(int i = dims - 1; i >= 0; i--)
+        {
+            if(step)
+            {
+                if(data && step[i] != CV_AUTOSTEP)
+                {
+                    total = step[i];
+                }
+                else
+                {
+                    step[i] = total;
+                }
+            }
+            total *= sizes[i];
+        }
+
+        CountedData* u = new CountedData(this);
+        u->data = u->origdata = data ? static_cast<uchar*>(data) : static_cast<uchar*>(cv::fastMalloc(total));
+        u->size = total;
+        if(data)
+        {
+            u->flags |= cv::UMatData::USER_ALLOCATED;
+        }
+        else if(u->frame > 0)
+        {
+            g_retainedBuffers++;
+        }
+        return u;
+    }
+
+    bool allocate(cv::UMatData* u, AccessFlags, cv::UMatUsageFlags) const
+    {
+        return u != NULL;
+    }
+
+    void deallocate(cv::UMatData* u) const
+    {
+        if(u == NULL)
+        {
+            return;
+        }
+        CountedData* counted = static_cast<CountedData*>(u);
+        if(!(u->flags & cv::UMatData::USER_ALLOCATED))
+        {
+            if(counted->frame > 0 && counted->frame == g_frame)
+            {
+                g_retainedBuffers--;
+            }
+            cv::fastFree(u->origdata);
+            u->origdata = NULL;
+        }
+        delete counted;
+    }
+};
+
+/*******************************************************************************************************************//**
+ * @brief Draws a synthetic eye frame with a dark pupil and a corneal glint
+ * @param[in] center the center of the pupil
+ * @param[in] size the axes of the pupil
+ * @param[in] channels the number of channels of the frame
+ * @param[out] frame the eye frame
+ **********************************************************************************************************************/
+static void drawEyeFrame(const cv::Point& center, const cv::Size& size, int channels, cv::Mat& frame)
+{
+    cv::Mat gray(FRAME_HEIGHT, FRAME_WIDTH, CV_8UC1, cv::Scalar(150));
+    cv::ellipse(gray, cv::RotatedRect(center, size, 20), cv::Scalar(30), -1);
+    cv::circle(gray, center + cv::Point(10, -8), 4, cv::Scalar(255), -1);
+    cv::GaussianBlur(gray, gray, cv::Size(5, 5), 0);
+    if(channels == 3)
+    {
+        cv::cvtColor(gray, frame, cv::COLOR_GRAY2BGR);
+    }
+    else
+    {
+        frame = gray;
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief Runs the tracker over a frame sequence and counts the allocations once the buffers have grown
+ * @param[in] tracker the pupil tracker
+ * @param[in] frames the frames, which are repeated in turn
+ * @param[in] frameCount the number of frames
+ * @param[in] name the name of the sequence to report
+ * @return true if the frames after the warm up did not allocate
+ **********************************************************************************************************************/
+static bool checkAllocations(PupilTracker& tracker, const cv::Mat* frames, int frameCount, const char* name)
+{
+    int found = 0;
+    for(int i = 0; i < WARMUP_CYCLES * frameCount; i++)
+    {
+        found += tracker.findPupil(frames[i % frameCount]);
+    }
+
+    g_retainedBlocks = 0;
+    g_retainedBuffers = 0;
+    g_trackerAllocations = 0;
+    for(int i = 0; i < TEST_FRAMES; i++)
+    {
+        g_frame = ++g_lastFrame;
+        found += tracker.findPupil(frames[i % frameCount]);
+    }
+    const long frame = g_frame;
+    g_frame = 0;
+
+    std::cout << name << ": " << g_retainedBuffers << " image buffers and " << g_retainedBlocks << " heap blocks kept, "
+              << g_trackerAllocations << " tracker allocations in " << TEST_FRAMES << " frames (up to frame " << frame
+              << "), pupil found in " << found << " of " << WARMUP_CYCLES * frameCount + TEST_FRAMES << " frames" << std::endl;
+    return g_retainedBuffers == 0 && g_retainedBlocks == 0 && g_trackerAllocations == 0 && found > 0;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Program entry point
+ *
+ * The repeated frame covers the tracking window and strong prior path. The alternating frames move the pupil out of
+ * the tracking window on every frame, so each one runs the coarse search and the full candidate evaluation. The
+ * moving colour frames change the pupil position and size on every frame, so the regions (and the buffers sized to
+ * them) differ from frame to frame, and the luma conversion runs on both the whole frame and the tracking window.
+ *
+ * @return 0 if no sequence allocated in its steady state
+ **********************************************************************************************************************/
+int main()
+{
+    // the allocator is never destroyed, since OpenCV may release its buffers during static destruction
+    cv::Mat::setDefaultAllocator(new CountingAllocator());
+
+    cv::Mat frames[2];
+    drawEyeFrame(cv::Point(FRAME_WIDTH / 2 - PUPIL_OFFSET, FRAME_HEIGHT / 2), cv::Size(60, 48), 1, frames[0]);
+    drawEyeFrame(cv::Point(FRAME_WIDTH / 2 + PUPIL_OFFSET, FRAME_HEIGHT / 2), cv::Size(60, 48), 1, frames[1]);
+
+    cv::Mat movingFrames[MOVING_FRAMES];
+    for(int i = 0; i < MOVING_FRAMES; i++)
+    {
+        const double angle = 2 * CV_PI * i / MOVING_FRAMES;
+        const cv::Point center(cvRound(FRAME_WIDTH / 2 + PUPIL_OFFSET * std::cos(angle)), cvRound(FRAME_HEIGHT / 2 + PUPIL_OFFSET / 2 * std::sin(angle)));
+        drawEyeFrame(center, cv::Size(50 + 4 * i, 42 + 3 * i), 3, movingFrames[i]);
+    }
+
+    PupilTracker tracker;
+    tracker.setDisplay(false);
+
+    bool success = checkAllocations(tracker, frames, 1, "repeated frame");
+    success = checkAllocations(tracker, frames, 2, "alternating frames") && success;
+    success = checkAllocations(tracker, movingFrames, MOVING_FRAMES, "moving colour pupil") && success;
+    return success ? 0 : 1;
+}
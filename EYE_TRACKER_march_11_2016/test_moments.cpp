@@ -0,0 +1,122 @@
+/*******************************************************************************************************************//**
+ * @file test_moments.cpp
+ * @brief Regression test for the contour moments of the canny pupil tracker fallback
+ *
+ * Fits ellipses to the moments of synthetic contours with the contour filling off (moments of the contour points) and
+ * on (moments of the enclosed areas, by Green's theorem). The filled moments do not depend on how densely the contour
+ * is sampled, and give axes of two standard deviations of the enclosed area, which is the semi-axis of an ellipse.
+ **********************************************************************************************************************/
+
+#include <iostream>
+#include <cmath>
+#include <vector>
+#include "opencv2/core/core.hpp"
+#include "PupilTracker.h"
+
+// the tracker widens the moments ellipse by this many pixels
+#define SIZE_MARGIN 5.0f
+
+static int g_failures = 0;
+
+/*******************************************************************************************************************//**
+ * @brief Reports a failed check
+ **********************************************************************************************************************/
+static void check(bool condition, const char* name)
+{
+    if(!condition)
+    {
+        std::cout << "FAILED: " << name << std::endl;
+        g_failures++;
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief Gets the polygon of an ellipse outline
+ * @param[in] center the center of the ellipse
+ * @param[in] a the semi-axis along the angle
+ * @param[in] b the other semi-axis
+ * @param[in] angle the angle in degrees
+ * @param[in] count the number of points of the polygon
+ * @param[in] denseHalf how many times more densely the half below the center is sampled
+ * @return the polygon
+ **********************************************************************************************************************/
+static std::vector<cv::Point> ellipseContour(const cv::Point2f& center, float a, float b, float angle, int count, int denseHalf)
+{
+    const double theta = angle * CV_PI / 180.0;
+    std::vector<cv::Point> contour;
+    for(int i = 0; i < count; i++)
+    {
+        const double t = 2 * CV_PI * i / count;
+        const int repeats = t < CV_PI ? denseHalf : 1;
+        for(int k = 0; k < repeats; k++)
+        {
+            const double s = t + 2 * CV_PI * k / (count * repeats);
+            const double x = a * std::cos(s), y = b * std::sin(s);
+            contour.push_back(cv::Point(cvRound(center.x + x * std::cos(theta) - y * std::sin(theta)), cvRound(center.y + x * std::sin(theta) + y * std::cos(theta))));
+        }
+    }
+    return contour;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Gets the moments ellipse of a single contour
+ **********************************************************************************************************************/
+static bool centroid(PupilTracker& tracker, bool fillContours, const std::vector<cv::Point>& contour, cv::RotatedRect& ellipse)
+{
+    tracker.setFillContours(fillContours);
+    return tracker.getEllipseCentroid(std::vector<std::vector<cv::Point> >(1, contour), ellipse);
+}
+
+/*******************************************************************************************************************//**
+ * @brief Program entry point
+ * @return 0 if all checks passed
+ **********************************************************************************************************************/
+int main()
+{
+    PupilTracker tracker;
+    const cv::Point2f center(100, 80);
+    cv::RotatedRect ellipse;
+
+    // a circle: both give its center, the filled moments give its radius
+    const std::vector<cv::Point> circle = ellipseContour(center, 30, 30, 0, 360, 1);
+    check(centroid(tracker, false, circle, ellipse), "circle points");
+    check(std::abs(ellipse.center.x - center.x) < 0.1f && std::abs(ellipse.center.y - center.y) < 0.1f, "circle points center");
+    check(std::abs(ellipse.size.width - 30 * std::sqrt(2.0f) - SIZE_MARGIN) < 0.5f, "circle points size");
+    check(centroid(tracker, true, circle, ellipse), "circle area");
+    check(std::abs(ellipse.center.x - center.x) < 0.1f && std::abs(ellipse.center.y - center.y) < 0.1f, "circle area center");
+    check(std::abs(ellipse.size.width - 30 - SIZE_MARGIN) < 0.5f && std::abs(ellipse.size.height - 30 - SIZE_MARGIN) < 0.5f, "circle area size");
+
+    // a circle sampled four times more densely on its lower half: only the contour points are pulled towards it
+    const std::vector<cv::Point> uneven = ellipseContour(center, 30, 30, 0, 360, 4);
+    check(centroid(tracker, false, uneven, ellipse), "uneven points");
+    check(ellipse.center.y - center.y > 5, "uneven points center");
+    check(centroid(tracker, true, uneven, ellipse), "uneven area");
+    check(std::abs(ellipse.center.x - center.x) < 0.1f && std::abs(ellipse.center.y - center.y) < 0.1f, "uneven area center");
+    check(std::abs(ellipse.size.width - 30 - SIZE_MARGIN) < 0.5f, "uneven area size");
+
+    // a rotated ellipse: the filled moments give its semi-axes and angle
+    const std::vector<cv::Point> rotated = ellipseContour(center, 40, 20, 30, 360, 1);
+    check(centroid(tracker, true, rotated, ellipse), "rotated area");
+    check(std::abs(ellipse.center.x - center.x) < 0.1f && std::abs(ellipse.center.y - center.y) < 0.1f, "rotated area center");
+    check(std::abs(std::max(ellipse.size.width, ellipse.size.height) - 40 - SIZE_MARGIN) < 0.5f, "rotated area major axis");
+    check(std::abs(std::min(ellipse.size.width, ellipse.size.height) - 20 - SIZE_MARGIN) < 0.5f, "rotated area minor axis");
+    const float angle = ellipse.size.width >= ellipse.size.height ? ellipse.angle : ellipse.angle - 90;
+    const float angleError = std::fmod(angle - 30 + 360, 180.0f);
+    check(std::min(angleError, 180 - angleError) < 1.0f, "rotated area angle");
+
+    // a line encloses no area, so only the contour points have moments
+    std::vector<cv::Point> line;
+    for(int i = 0; i < 20; i++)
+    {
+        line.push_back(cv::Point(10 + i, 10 + i));
+    }
+    check(centroid(tracker, false, line, ellipse), "line points");
+    check(!centroid(tracker, true, line, ellipse), "line area");
+
+    // no contours have no moments
+    tracker.setFillContours(true);
+    check(!tracker.getEllipseCentroid(std::vector<std::vector<cv::Point> >(), ellipse), "no contours");
+
+    std::cout << (g_failures == 0 ? "all checks passed" : "some checks failed") << std::endl;
+    return g_failures == 0 ? 0 : 1;
+}
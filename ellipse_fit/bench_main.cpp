@@ -0,0 +1,154 @@
+/*******************************************************************************************************************//**
+ * @file bench_main.cpp
+ * @brief Micro-benchmark of the ellipse fitting library
+ *
+ * Fits noisy elliptic arcs of pupil-like size with every fitter of EllipseFit.h, and reports the cost per fit and per
+ * point. Usage: ellipse_fit_bench [repetitions]
+ ***********************************************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <random>
+#include <chrono>
+#include "EllipseFit.h"
+
+// configuration parameters
+#define NUM_CONTOURS 256
+#define INLIER_THRESHOLD 1.5f
+
+struct PointI
+{
+    int x, y;
+};
+
+struct PointF
+{
+    float x, y;
+};
+
+// noisy arcs of random ellipses, stored in a flat arena as the contour finders do
+void makeArcs(int pointsPerArc, std::vector<PointF>& points, std::vector<PointI>& rounded, std::vector<int>& offsets)
+{
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::normal_distribution<double> noise(0, 0.5);
+
+    points.clear();
+    rounded.clear();
+    offsets.assign(1, 0);
+    for (int c = 0; c < NUM_CONTOURS; c++)
+    {
+        const double cx = 100 + 440 * uniform(rng), cy = 100 + 280 * uniform(rng);
+        const double a = 10 + 50 * uniform(rng), b = a * (0.5 + 0.5 * uniform(rng));
+        const double theta = M_PI * uniform(rng), start = 2 * M_PI * uniform(rng), span = M_PI * (0.5 + 1.5 * uniform(rng));
+        for (int i = 0; i < pointsPerArc; i++)
+        {
+            const double t = start + span * i / pointsPerArc;
+            const double x = a * cos(t), y = b * sin(t);
+            PointF p = {float(cx + x * cos(theta) - y * sin(theta) + noise(rng)),
+                float(cy + x * sin(theta) + y * cos(theta) + noise(rng))};
+            PointI q = {int(lround(p.x)), int(lround(p.y))};
+            points.push_back(p);
+            rounded.push_back(q);
+        }
+        offsets.push_back(static_cast<int>(points.size()));
+    }
+}
+
+// runs the body the given number of times and returns the average microseconds per run
+template<typename F>
+double timeUs(int repetitions, F body)
+{
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repetitions; r++)
+    {
+        body();
+    }
+    const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / repetitions;
+}
+
+/*******************************************************************************************************************//**
+ * @brief program entry point
+ * @param[in] argc number of command line arguments
+ * @param[in] argv string array of command line arguments
+ * @return return code (0 for normal termination)
+ ***********************************************************************************************************************/
+int main(int argc, char** argv)
+{
+    const int repetitions = argc > 1 ? atoi(argv[1]) : 20;
+    if (repetitions <= 0)
+    {
+        printf("USAGE: %s [repetitions] \n", argv[0]);
+        return 0;
+    }
+
+    const int sizes[] = {16, 64, 256, 1024};
+    std::vector<PointF> points;
+    std::vector<PointI> rounded;
+    std::vector<int> offsets;
+    std::vector<ellipse_fit::Conic> conics(NUM_CONTOURS);
+    std::vector<float> distances, workspace;
+    volatile float sink = 0;
+
+#if defined(__SSE2__)
+    printf("residual kernels: SSE2\n");
+#else
+    printf("residual kernels: scalar\n");
+#endif
+    printf("%6s %12s %12s %12s %12s %12s\n", "points", "moments", "algebraic", "geometric", "sampson", "inliers");
+    printf("%6s %12s %12s %12s %12s %12s\n", "", "us/fit", "us/fit", "us/fit", "ns/point", "ns/point");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        const int n = sizes[s];
+        makeArcs(n, points, rounded, offsets);
+        distances.resize(points.size());
+
+        const double moments = timeUs(repetitions, [&]() {
+            for (int c = 0; c < NUM_CONTOURS; c++)
+            {
+                ellipse_fit::Ellipse e;
+                if (ellipse_fit::fitMoments(ellipse_fit::pointMoments(&rounded[offsets[c]], n), e))
+                {
+                    sink = sink + e.width;
+                }
+            }
+        }) / NUM_CONTOURS;
+
+        const double algebraic = timeUs(repetitions, [&]() {
+            for (int c = 0; c < NUM_CONTOURS; c++)
+            {
+                ellipse_fit::fitAlgebraic(&rounded[offsets[c]], n, conics[c]);
+            }
+        }) / NUM_CONTOURS;
+
+        const double geometric = timeUs(repetitions, [&]() {
+            for (int c = 0; c < NUM_CONTOURS; c++)
+            {
+                ellipse_fit::fitGeometric(&points[offsets[c]], n, conics[c], 2, &workspace);
+            }
+        }) / NUM_CONTOURS;
+
+        // residuals of every contour against its own fit
+        const double sampson = 1000 * timeUs(repetitions, [&]() {
+            for (int c = 0; c < NUM_CONTOURS; c++)
+            {
+                ellipse_fit::sampsonDistances(conics[c], &rounded[offsets[c]].x, n, &distances[offsets[c]]);
+            }
+        }) / points.size();
+
+        const double inliers = 1000 * timeUs(repetitions, [&]() {
+            for (int c = 0; c < NUM_CONTOURS; c++)
+            {
+                sink = sink + ellipse_fit::countInliers(conics[c], &rounded[offsets[c]].x, n, INLIER_THRESHOLD);
+            }
+        }) / points.size();
+
+        printf("%6d %12.3f %12.3f %12.3f %12.3f %12.3f\n", n, moments, algebraic, geometric, sampson, inliers);
+    }
+
+    return 0;
+}
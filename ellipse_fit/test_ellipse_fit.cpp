@@ -0,0 +1,181 @@
+/*******************************************************************************************************************//**
+ * @file test_ellipse_fit.cpp
+ * @brief Regression test of the ellipse fitting library
+ *
+ * Fits synthetic ellipses with known centre, axes and angle: the algebraic fit of full and partial arcs and of exactly
+ * five points, the conic conversions, the residual kernels and the moment fit of a filled ellipse. Point sets that no
+ * ellipse fits (too few or collinear points, empty moments) must be rejected.
+ ***********************************************************************************************************************/
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include "EllipseFit.h"
+
+// the synthetic ellipse
+#define CENTER_X 120.0
+#define CENTER_Y 90.0
+#define SEMI_MAJOR 40.0
+#define SEMI_MINOR 25.0
+#define ANGLE 30.0
+
+struct PointF
+{
+    float x, y;
+};
+
+static int g_failures = 0;
+
+/*******************************************************************************************************************//**
+ * @brief Reports a failed check
+ **********************************************************************************************************************/
+static void check(bool condition, const char* name)
+{
+    if (!condition)
+    {
+        printf("FAILED: %s\n", name);
+        g_failures++;
+    }
+}
+
+/*******************************************************************************************************************//**
+ * @brief Gets points of the synthetic ellipse
+ * @param[in] start the parameter of the first point in degrees
+ * @param[in] span the parameter range of the arc in degrees
+ * @param[in] count the number of points
+ * @return the points
+ **********************************************************************************************************************/
+static std::vector<PointF> ellipseArc(double start, double span, int count)
+{
+    const double theta = ANGLE * M_PI / 180;
+    std::vector<PointF> points;
+    for (int i = 0; i < count; i++)
+    {
+        const double t = (start + span * i / count) * M_PI / 180;
+        const double x = SEMI_MAJOR * cos(t), y = SEMI_MINOR * sin(t);
+        PointF p = {float(CENTER_X + x * cos(theta) - y * sin(theta)), float(CENTER_Y + x * sin(theta) + y * cos(theta))};
+        points.push_back(p);
+    }
+    return points;
+}
+
+/*******************************************************************************************************************//**
+ * @brief Checks that an ellipse is the synthetic one, with the given axes
+ * @param[in] e the ellipse, whose width may be either axis
+ * @param[in] major the expected major axis
+ * @param[in] minor the expected minor axis
+ * @param[in] tolerance the largest error of the centre and axes in pixels
+ * @param[in] name the name of the check to report
+ **********************************************************************************************************************/
+static void checkEllipse(const ellipse_fit::Ellipse& e, double major, double minor, double tolerance, const char* name)
+{
+    const bool wide = e.width >= e.height;
+    const double angleError = fmod(fabs((wide ? e.angle : e.angle - 90) - ANGLE) + 360, 180.0);
+    const bool matches = fabs(e.cx - CENTER_X) < tolerance && fabs(e.cy - CENTER_Y) < tolerance
+        && fabs((wide ? e.width : e.height) - major) < tolerance && fabs((wide ? e.height : e.width) - minor) < tolerance
+        && std::min(angleError, 180 - angleError) < 0.5;
+    if (!matches)
+    {
+        printf("%s: centre (%.3f, %.3f) axes %.3f x %.3f angle %.3f\n", name, e.cx, e.cy, e.width, e.height, e.angle);
+    }
+    check(matches, name);
+}
+
+/*******************************************************************************************************************//**
+ * @brief Checks the algebraic fit of a point set against the synthetic ellipse
+ **********************************************************************************************************************/
+static void checkAlgebraicFit(const std::vector<PointF>& points, double tolerance, const char* name)
+{
+    ellipse_fit::Conic conic;
+    ellipse_fit::Ellipse e = {0, 0, 0, 0, 0};
+    const bool fitted = ellipse_fit::fitAlgebraic(&points[0], static_cast<int>(points.size()), conic);
+    check(fitted && conic.isEllipse() && conic.A + conic.C > 0, name);
+    check(fitted && ellipse_fit::ellipseFromConic(conic, e), name);
+    checkEllipse(e, 2 * SEMI_MAJOR, 2 * SEMI_MINOR, tolerance, name);
+}
+
+/*******************************************************************************************************************//**
+ * @brief program entry point
+ * @return 0 if all checks passed
+ **********************************************************************************************************************/
+int main()
+{
+    // full and partial arcs of the rotated ellipse, and exactly five of its points
+    checkAlgebraicFit(ellipseArc(0, 360, 64), 0.01, "full arc");
+    checkAlgebraicFit(ellipseArc(200, 120, 32), 0.05, "partial arc");
+    checkAlgebraicFit(ellipseArc(10, 300, 5), 0.05, "five points");
+
+    // the conic of the ellipse gives the ellipse back, and is -1 at the centre
+    const ellipse_fit::Ellipse synthetic = {float(CENTER_X), float(CENTER_Y), float(2 * SEMI_MAJOR), float(2 * SEMI_MINOR), float(ANGLE)};
+    const ellipse_fit::Conic conic = ellipse_fit::conicFromEllipse(synthetic);
+    ellipse_fit::Ellipse e = {0, 0, 0, 0, 0};
+    check(ellipse_fit::ellipseFromConic(conic, e), "conic round trip");
+    checkEllipse(e, 2 * SEMI_MAJOR, 2 * SEMI_MINOR, 0.01, "conic round trip");
+    check(fabs(ellipse_fit::algebraicDistance(conic, float(CENTER_X), float(CENTER_Y)) + 1) < 1e-3, "conic centre");
+
+    // the Sampson distance is about the distance in pixels, and the inlier count agrees with it for any point count
+    const double theta = ANGLE * M_PI / 180;
+    check(fabs(ellipse_fit::sampsonDistance(conic, float(CENTER_X + (SEMI_MAJOR + 1) * cos(theta)), float(CENTER_Y + (SEMI_MAJOR + 1) * sin(theta))) - 1) < 0.05,
+        "sampson distance outside");
+    check(fabs(ellipse_fit::sampsonDistance(conic, float(CENTER_X - (SEMI_MINOR - 1) * sin(theta)), float(CENTER_Y + (SEMI_MINOR - 1) * cos(theta))) + 1) < 0.05,
+        "sampson distance inside");
+    std::vector<PointF> scattered;
+    for (int i = 0; i < 103; i++)
+    {
+        const double t = 2 * M_PI * i / 103, r = 1 + 0.1 * ((i * 7) % 11 - 5);
+        PointF p = {float(CENTER_X + r * SEMI_MAJOR * cos(t)), float(CENTER_Y + r * SEMI_MINOR * sin(t))};
+        scattered.push_back(p);
+    }
+    std::vector<float> distances(scattered.size());
+    for (int n = 0; n <= static_cast<int>(scattered.size()); n += 17)
+    {
+        ellipse_fit::sampsonDistances(conic, &scattered[0].x, n, &distances[0]);
+        int inliers = 0, consistent = 0;
+        for (int i = 0; i < n; i++)
+        {
+            inliers += fabs(distances[i]) < 2.0f;
+            consistent += fabs(distances[i] - ellipse_fit::sampsonDistance(conic, scattered[i].x, scattered[i].y)) < 1e-4;
+        }
+        check(consistent == n, "sampson distances");
+        check(ellipse_fit::countInliers(conic, &scattered[0].x, n, 2.0f) == inliers, "inlier count");
+    }
+
+    // too few and collinear points fit no ellipse
+    ellipse_fit::Conic none;
+    const std::vector<PointF> four = ellipseArc(0, 360, 4);
+    check(!ellipse_fit::fitAlgebraic(&four[0], 4, none), "four points");
+    std::vector<PointF> line;
+    for (int i = 0; i < 20; i++)
+    {
+        PointF p = {float(10 + 3 * i), float(20 + 2 * i)};
+        line.push_back(p);
+    }
+    check(!ellipse_fit::fitAlgebraic(&line[0], static_cast<int>(line.size()), none), "collinear points");
+    check(!ellipse_fit::ellipseFromConic(none, e), "collinear points conic");
+
+    // the moments of the filled ellipse give its semi-axes (two standard deviations) and angle
+    std::vector<PointF> area;
+    for (int y = 0; y < 200; y++)
+    {
+        for (int x = 0; x < 240; x++)
+        {
+            const double dx = x - CENTER_X, dy = y - CENTER_Y;
+            const double u = dx * cos(theta) + dy * sin(theta), v = -dx * sin(theta) + dy * cos(theta);
+            if ((u * u) / (SEMI_MAJOR * SEMI_MAJOR) + (v * v) / (SEMI_MINOR * SEMI_MINOR) <= 1)
+            {
+                PointF p = {float(x), float(y)};
+                area.push_back(p);
+            }
+        }
+    }
+    e = ellipse_fit::Ellipse();
+    check(ellipse_fit::fitMoments(ellipse_fit::pointMoments(&area[0], static_cast<int>(area.size())), e), "filled moments");
+    checkEllipse(e, SEMI_MAJOR, SEMI_MINOR, 0.2, "filled moments");
+
+    // empty moments have no ellipse
+    const ellipse_fit::Moments empty = {0, 0, 0, 0, 0, 0};
+    check(!ellipse_fit::fitMoments(empty, e), "empty moments");
+
+    printf(g_failures == 0 ? "all checks passed\n" : "some checks failed\n");
+    return g_failures == 0 ? 0 : 1;
+}
@@ -33,6 +33,7 @@
 #define EARLY_TERMINATION_PERCENTAGE 95
 #define EARLY_REJECTION true
 #define SEED_VALUE -1
+#define ELLIPSE_FITTER PupilTracker::FITTER_RANSAC
 
 // color constants
 CvScalar COLOR_WHITE = CV_RGB(255, 255, 255);
@@ -75,6 +76,7 @@ bool processImage(const cv::Mat& imageIn, PupilData& result)
     params.EarlyTerminationPercentage = EARLY_TERMINATION_PERCENTAGE;
     params.EarlyRejection = EARLY_REJECTION;
     params.Seed = SEED_VALUE;
+    params.Fitter = ELLIPSE_FITTER;
 
     // perform the pupil ellipse fitting
     PupilTracker::findPupilEllipse_out out;
@@ -29,6 +29,7 @@ public:
         ss.setf(std::ios::fixed);
         ss << (val.elapsed() * 1000.0) << "ms";
         m_log.push_back(std::make_pair(key, ss.str()));
+        m_times.push_back(std::make_pair(key, val.elapsed() * 1000.0));
 
         //printf("%s %s\n", key, ss.str());
     }
@@ -50,13 +51,30 @@ public:
         return m_log.end();
     }
 
+    // Time of a logged section in milliseconds, or -1 if it did not run
+    double time(const std::string& key) const
+    {
+        for (size_t i = 0; i < m_times.size(); ++i)
+            if (m_times[i].first == key)
+                return m_times[i].second;
+        return -1;
+    }
+
 private:
     std::vector<std::pair<std::string, std::string> > m_log;
+    std::vector<std::pair<std::string, double> > m_times;
 };
 
 namespace PupilTracker
 {
 
+// Ellipse fitters of the "Ellipse fitting" section
+enum EllipseFitter
+{
+    FITTER_RANSAC, // randomised, image aware RANSAC
+    FITTER_VOTING  // deterministic gradient voting for the centre, and a least squares fit
+};
+
 struct TrackerParams
 {
     int Radius_Min;
@@ -73,6 +91,15 @@ struct TrackerParams
     int EarlyTerminationPercentage;
     bool EarlyRejection;
     int Seed;
+
+    // Quality bounds, which trade accuracy for time (0 means unlimited)
+    int HaarStride;
+    int MaxRansacIterations;
+    int MaxEdgePoints;
+
+    EllipseFitter Fitter;
+
+    TrackerParams() : HaarStride(4), MaxRansacIterations(0), MaxEdgePoints(0), Fitter(FITTER_RANSAC) {}
 };
 
 const cv::Point2f UNKNOWN_POSITION = cv::Point2f(-1, -1);
@@ -131,6 +158,10 @@ struct findPupilEllipse_out
 
 bool findPupilEllipse(const TrackerParams& params, const cv::Mat& m, findPupilEllipse_out& out, tracker_log& log);
 
+// Takes the pupil position and size from a seed ellipse (e.g. from a cheaper tracker) instead of the Haar search;
+// an empty seed searches as above
+bool findPupilEllipse(const TrackerParams& params, const cv::Mat& m, const cv::RotatedRect& seed, findPupilEllipse_out& out, tracker_log& log);
+
 }//PupilTracker
 
 #endif//__PUPILTRACKER_H__
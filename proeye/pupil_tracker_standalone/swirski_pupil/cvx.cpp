@@ -1,4 +1,7 @@
 #include "cvx.h"
+#include "EllipseFitCv.h"
+
+#include <tbb/tbb.h>
 
 
 void cvx::getROI(const cv::Mat& src, cv::Mat& dst, const cv::Rect& roi, int borderType)
@@ -119,40 +122,121 @@ float cvx::histKmeans(const cv::Mat_<float>& hist, int bin_min, int bin_max, int
     return std::numeric_limits<float>::infinity();
 }
 
-cv::RotatedRect cvx::fitEllipse(const cv::Moments& m)
+bool cvx::fitEllipse(const cv::Moments& m, cv::RotatedRect& ellipse)
 {
-    cv::RotatedRect ret;
+    return ellipse_fit::fitEllipse(m, ellipse);
+}
+cv::Vec2f cvx::majorAxis(const cv::RotatedRect& ellipse)
+{
+    return cv::Vec2f(static_cast<float>(ellipse.size.width*std::cos(PI/180*ellipse.angle)), static_cast<float>(ellipse.size.width*std::sin(PI/180*ellipse.angle)));
+}
 
-    ret.center.x = static_cast<float>(m.m10/m.m00);
-    ret.center.y = static_cast<float>(m.m01/m.m00);
+namespace
+{
+    // Prefix sums along one row of the replicate-padded image: out[0] = 0, and out[x] is the sum of the first x
+    // padded pixels. The border pixels are read from the row ends rather than from a padded copy.
+    inline void paddedRowPrefix(const uchar* src, int cols, int padding, int* out)
+    {
+        int sum = 0;
+        *out++ = 0;
+        for (int i = 0; i < padding; ++i)
+            *out++ = (sum += src[0]);
+        for (int i = 0; i < cols; ++i)
+            *out++ = (sum += src[i]);
+        for (int i = 0; i < padding; ++i)
+            *out++ = (sum += src[cols - 1]);
+    }
+}
 
-    double mu20 = m.m20/m.m00 - ret.center.x*ret.center.x;
-    double mu02 = m.m02/m.m00 - ret.center.y*ret.center.y;
-    double mu11 = m.m11/m.m00 - ret.center.x*ret.center.y;
+void cvx::integralReplicate(const cv::Mat_<uchar>& src, cv::Mat_<int32_t>& dst, int padding)
+{
+    CV_Assert(!src.empty() && padding >= 0);
 
-    double common = std::sqrt(sq(mu20 - mu02) + 4*sq(mu11));
+    const int rows = src.rows + 2*padding;
+    const int cols = src.cols + 2*padding;
+    dst.create(rows + 1, cols + 1);
+    std::fill(dst[0], dst[0] + cols + 1, 0);
 
-    ret.size.width = static_cast<float>(std::sqrt(2*(mu20 + mu02 + common)));
-    ret.size.height = static_cast<float>(std::sqrt(2*(mu20 + mu02 - common)));
+    // Split the padded rows into strips. Each strip is summed from zero in parallel, then the column totals of
+    // the strips above it are carried in. All sums are integer, so this is exact.
+    const int stripHeight = (rows + 7) / 8;
+    const int numStrips = (rows + stripHeight - 1) / stripHeight;
 
-    double num, den;
-    if (mu02 > mu20) {
-        num = mu02 - mu20 + common;
-        den = 2*mu11;
-    }
-    else {
-        num = 2*mu11;
-        den = mu20 - mu02 + common;
+    tbb::parallel_for(0, numStrips, [&] (int s)
+    {
+        const int y0 = s*stripHeight;
+        const int y1 = std::min(rows, y0 + stripHeight);
+        std::vector<int> rowSum(cols + 1);
+
+        for (int y = y0; y < y1; ++y)
+        {
+            const int srcY = std::min(std::max(y - padding, 0), src.rows - 1);
+            paddedRowPrefix(src[srcY], src.cols, padding, &rowSum[0]);
+
+            int* out = dst[y + 1];
+            if (y == y0)
+            {
+                std::copy(rowSum.begin(), rowSum.end(), out);
+            }
+            else
+            {
+                const int* prev = dst[y];
+                for (int x = 0; x <= cols; ++x)
+                    out[x] = prev[x] + rowSum[x];
+            }
+        }
+    });
+
+    // Carry for each strip is the sum of the last rows of every strip above it
+    cv::Mat_<int32_t> carry(numStrips, cols + 1, 0);
+    for (int s = 1; s < numStrips; ++s)
+    {
+        const int* last = dst[s*stripHeight];
+        const int* prevCarry = carry[s - 1];
+        int* c = carry[s];
+        for (int x = 0; x <= cols; ++x)
+            c[x] = prevCarry[x] + last[x];
     }
 
-    if (num == 0 && den == 0)
-        ret.angle = 0;
-    else
-        ret.angle = static_cast<float>((180/PI) * std::atan2(num,den));
+    tbb::parallel_for(1, numStrips, [&] (int s)
+    {
+        const int y0 = s*stripHeight;
+        const int y1 = std::min(rows, y0 + stripHeight);
+        const int* c = carry[s];
 
-    return ret;
+        for (int y = y0; y < y1; ++y)
+        {
+            int* out = dst[y + 1];
+            for (int x = 0; x <= cols; ++x)
+                out[x] += c[x];
+        }
+    });
 }
-cv::Vec2f cvx::majorAxis(const cv::RotatedRect& ellipse)
+
+cv::Mat cvx::lumaPlane(const uchar* data, int width, int height, size_t step, PixelFormat format, cv::Mat& buffer)
 {
-    return cv::Vec2f(static_cast<float>(ellipse.size.width*std::cos(PI/180*ellipse.angle)), static_cast<float>(ellipse.size.width*std::sin(PI/180*ellipse.angle)));
+    uchar* pixels = const_cast<uchar*>(data);
+
+    switch (format)
+    {
+    case PIXEL_FORMAT_MONO8:
+    case PIXEL_FORMAT_NV12:
+        // The Y plane comes first in NV12, so both are a plain 8 bit image over the start of the buffer
+        return cv::Mat(height, width, CV_8UC1, pixels, step);
+
+    case PIXEL_FORMAT_YUYV:
+        cv::extractChannel(cv::Mat(height, width, CV_8UC2, pixels, step), buffer, 0);
+        return buffer;
+
+    case PIXEL_FORMAT_UYVY:
+        cv::extractChannel(cv::Mat(height, width, CV_8UC2, pixels, step), buffer, 1);
+        return buffer;
+
+    case PIXEL_FORMAT_BGR8:
+        cv::cvtColor(cv::Mat(height, width, CV_8UC3, pixels, step), buffer, CV_BGR2GRAY);
+        return buffer;
+
+    default:
+        throw std::runtime_error("Unsupported pixel format");
+    }
 }
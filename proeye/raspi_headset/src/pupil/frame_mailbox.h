@@ -0,0 +1,93 @@
+/*******************************************************************************************************************//**
+ * @FILE frame_mailbox.h
+ * @BRIEF single slot hand-off of image messages from the ROS spinner thread to the tracking thread
+ *
+ * The spinner thread only posts incoming frames, and the tracking thread always takes the newest one. A frame that is
+ * replaced before it was taken is dropped and counted, so the tracker never works through a backlog of old images.
+ **********************************************************************************************************************/
+
+#ifndef FRAME_MAILBOX_H
+#define FRAME_MAILBOX_H
+
+#include <ros/ros.h>
+#include <sensor_msgs/Image.h>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+class FrameMailbox
+{
+public:
+    FrameMailbox() : m_replacedCount(0)
+    {
+    }
+
+    /***************************************************************************************************************//**
+     * @BRIEF posts a new frame, replacing any frame that has not been taken yet
+     *
+     * @PARAM[in] msg input image message
+     ******************************************************************************************************************/
+    void post(const sensor_msgs::ImageConstPtr& msg)
+    {
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            if(m_frame)
+            {
+                m_replacedCount++;
+            }
+            m_frame = msg;
+            m_received = ros::Time::now();
+        }
+        m_condition.notify_one();
+    }
+
+    /***************************************************************************************************************//**
+     * @BRIEF waits for the newest frame and removes it from the mailbox
+     *
+     * @PARAM[out] msg the newest image message
+     * @PARAM[out] received the time at which the frame was posted
+     * @PARAM[in] timeout the longest time to wait for a frame
+     * @RETURNS true if a frame was taken, false if the wait timed out
+     ******************************************************************************************************************/
+    bool take(sensor_msgs::ImageConstPtr& msg, ros::Time& received, const ros::WallDuration& timeout)
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        boost::system_time deadline = boost::get_system_time() + boost::posix_time::microseconds(timeout.toNSec() / 1000);
+        while(!m_frame)
+        {
+            if(!m_condition.timed_wait(lock, deadline))
+            {
+                break;
+            }
+        }
+        if(!m_frame)
+        {
+            return false;
+        }
+        msg = m_frame;
+        received = m_received;
+        m_frame.reset();
+        return true;
+    }
+
+    /***************************************************************************************************************//**
+     * @BRIEF gets the number of frames replaced before they were taken, and resets the count
+     *
+     * @RETURNS the number of replaced frames since the last call
+     ******************************************************************************************************************/
+    unsigned int takeReplacedCount()
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        unsigned int count = m_replacedCount;
+        m_replacedCount = 0;
+        return count;
+    }
+
+private:
+    boost::mutex m_mutex;
+    boost::condition_variable m_condition;
+    sensor_msgs::ImageConstPtr m_frame;
+    ros::Time m_received;
+    unsigned int m_replacedCount;
+};
+
+#endif // FRAME_MAILBOX_H
@@ -0,0 +1,560 @@
+#ifndef __ELLIPSE_FIT_H__
+#define __ELLIPSE_FIT_H__
+
+// Header-only ellipse fitting shared by the pupil trackers. It depends only on the standard library, the OpenCV
+// adapters are in EllipseFitCv.h. Points are any type with x and y members, the residual kernels take the points as
+// interleaved x, y pairs (the layout of cv::Point and cv::Point2f).
+
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace ellipse_fit
+{
+
+    // Conic section A x^2 + B xy + C y^2 + D x + E y + F = 0
+    struct Conic
+    {
+        float A, B, C, D, E, F;
+
+        // the conic 1 = 0, which has no points and is far from every point
+        static Conic none()
+        {
+            Conic q = {0, 0, 0, 0, 0, 1};
+            return q;
+        }
+
+        bool isEllipse() const
+        {
+            return 4.0 * A * C - double(B) * B > 0;
+        }
+    };
+
+    // Ellipse with the full axis lengths, and the angle of the width axis in degrees (the cv::RotatedRect convention)
+    struct Ellipse
+    {
+        float cx, cy;
+        float width, height;
+        float angle;
+    };
+
+    // Spatial moments up to second order
+    struct Moments
+    {
+        double m00, m10, m01, m20, m11, m02;
+    };
+
+    const double DEGREES_PER_RADIAN = 57.295779513082321;
+
+    // --------------------------------------------------------------------------------------------------------------
+    // Conversions
+    // --------------------------------------------------------------------------------------------------------------
+
+    // Conic of an ellipse, scaled so that F is the value at the centre minus one (as ConicSection)
+    inline Conic conicFromEllipse(const Ellipse& e)
+    {
+        const double ax = std::cos(e.angle / DEGREES_PER_RADIAN), ay = std::sin(e.angle / DEGREES_PER_RADIAN);
+        const double cx = e.cx, cy = e.cy;
+        const double a2 = 0.25 * e.width * e.width, b2 = 0.25 * e.height * e.height;
+
+        Conic q;
+        q.A = float(ax*ax / a2 + ay*ay / b2);
+        q.B = float(2*ax*ay / a2 - 2*ax*ay / b2);
+        q.C = float(ay*ay / a2 + ax*ax / b2);
+        q.D = float((-2*ax*ay*cy - 2*ax*ax*cx) / a2 + (2*ax*ay*cy - 2*ay*ay*cx) / b2);
+        q.E = float((-2*ax*ay*cx - 2*ay*ay*cy) / a2 + (2*ax*ay*cx - 2*ax*ax*cy) / b2);
+        q.F = float((2*ax*ay*cx*cy + ax*ax*cx*cx + ay*ay*cy*cy) / a2
+            + (-2*ax*ay*cx*cy + ay*ay*cx*cx + ax*ax*cy*cy) / b2
+            - 1);
+        return q;
+    }
+
+    // Centre, axes and angle of a conic, false if the conic is not a real ellipse
+    inline bool ellipseFromConic(const Conic& q, Ellipse& e)
+    {
+        const double A = q.A, B = q.B, C = q.C, D = q.D, E = q.E, F = q.F;
+        const double det = 4*A*C - B*B;
+        if (!(det > 0))
+            return false;
+
+        // the centre is where the gradient vanishes, f0 is the conic value there
+        const double cx = (B*E - 2*C*D) / det;
+        const double cy = (B*D - 2*A*E) / det;
+        const double f0 = F + 0.5 * (D*cx + E*cy);
+
+        // principal directions of the quadratic part
+        const double theta = 0.5 * std::atan2(B, A - C);
+        const double c = std::cos(theta), s = std::sin(theta);
+        const double la = A*c*c + B*c*s + C*s*s;
+        const double lb = A + C - la;
+        const double ra = -f0 / la, rb = -f0 / lb;
+        if (!(ra > 0 && rb > 0))
+            return false;
+
+        e.cx = float(cx);
+        e.cy = float(cy);
+        e.width = float(2 * std::sqrt(ra));
+        e.height = float(2 * std::sqrt(rb));
+        e.angle = float(DEGREES_PER_RADIAN * theta);
+        return true;
+    }
+
+    // --------------------------------------------------------------------------------------------------------------
+    // Moment fit
+    // --------------------------------------------------------------------------------------------------------------
+
+    template<typename P>
+    Moments pointMoments(const P* points, int n)
+    {
+        Moments m = {0, 0, 0, 0, 0, 0};
+        m.m00 = n;
+        for (int i = 0; i < n; i++)
+        {
+            const double x = points[i].x, y = points[i].y;
+            m.m10 += x;
+            m.m01 += y;
+            m.m20 += x * x;
+            m.m11 += x * y;
+            m.m02 += y * y;
+        }
+        return m;
+    }
+
+    // Ellipse with the mean and principal directions of the moments, the axes are two standard deviations along them.
+    // This is the coarse fit of cvx::fitEllipse(cv::Moments), false if the moments are empty
+    inline bool fitMoments(const Moments& m, Ellipse& e)
+    {
+        if (!(m.m00 > 0))
+            return false;
+
+        const double cx = m.m10 / m.m00, cy = m.m01 / m.m00;
+        const double mu20 = m.m20 / m.m00 - cx*cx;
+        const double mu02 = m.m02 / m.m00 - cy*cy;
+        const double mu11 = m.m11 / m.m00 - cx*cy;
+
+        const double common = std::sqrt((mu20 - mu02)*(mu20 - mu02) + 4*mu11*mu11);
+
+        e.cx = float(cx);
+        e.cy = float(cy);
+        e.width = float(std::sqrt(std::max(2*(mu20 + mu02 + common), 0.0)));
+        e.height = float(std::sqrt(std::max(2*(mu20 + mu02 - common), 0.0)));
+
+        double num, den;
+        if (mu02 > mu20)
+        {
+            num = mu02 - mu20 + common;
+            den = 2*mu11;
+        }
+        else
+        {
+            num = 2*mu11;
+            den = mu20 - mu02 + common;
+        }
+        e.angle = (num == 0 && den == 0) ? 0.0f : float(DEGREES_PER_RADIAN * std::atan2(num, den));
+        return true;
+    }
+
+    // --------------------------------------------------------------------------------------------------------------
+    // Algebraic fit
+    // --------------------------------------------------------------------------------------------------------------
+
+    namespace detail
+    {
+        typedef double Mat3[3][3];
+
+        inline void mul(const Mat3& a, const Mat3& b, Mat3& out)
+        {
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 3; j++)
+                    out[i][j] = a[i][0]*b[0][j] + a[i][1]*b[1][j] + a[i][2]*b[2][j];
+        }
+
+        inline bool inverse(const Mat3& m, Mat3& out, double minDet)
+        {
+            const double c00 = m[1][1]*m[2][2] - m[1][2]*m[2][1];
+            const double c01 = m[1][2]*m[2][0] - m[1][0]*m[2][2];
+            const double c02 = m[1][0]*m[2][1] - m[1][1]*m[2][0];
+            const double det = m[0][0]*c00 + m[0][1]*c01 + m[0][2]*c02;
+            if (!(std::abs(det) > minDet))
+                return false;
+
+            const double inv = 1 / det;
+            out[0][0] = c00 * inv;
+            out[1][0] = c01 * inv;
+            out[2][0] = c02 * inv;
+            out[0][1] = (m[0][2]*m[2][1] - m[0][1]*m[2][2]) * inv;
+            out[1][1] = (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv;
+            out[2][1] = (m[0][1]*m[2][0] - m[0][0]*m[2][1]) * inv;
+            out[0][2] = (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv;
+            out[1][2] = (m[0][2]*m[1][0] - m[0][0]*m[1][2]) * inv;
+            out[2][2] = (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv;
+            return true;
+        }
+
+        // Real roots of the characteristic polynomial of m
+        inline int eigenvalues(const Mat3& m, double* roots)
+        {
+            const double a = -(m[0][0] + m[1][1] + m[2][2]);
+            const double b = m[0][0]*m[1][1] - m[0][1]*m[1][0]
+                + m[0][0]*m[2][2] - m[0][2]*m[2][0]
+                + m[1][1]*m[2][2] - m[1][2]*m[2][1];
+            const double c = -(m[0][0]*(m[1][1]*m[2][2] - m[1][2]*m[2][1])
+                - m[0][1]*(m[1][0]*m[2][2] - m[1][2]*m[2][0])
+                + m[0][2]*(m[1][0]*m[2][1] - m[1][1]*m[2][0]));
+
+            // depressed cubic t^3 + p t + q = 0 with lambda = t - a/3
+            const double p = b - a*a / 3;
+            const double q = 2*a*a*a / 27 - a*b / 3 + c;
+            const double shift = -a / 3;
+            const double disc = q*q / 4 + p*p*p / 27;
+            if (p < 0 && disc <= 0)
+            {
+                // three real roots (trigonometric form)
+                const double r = 2 * std::sqrt(-p / 3);
+                const double arg = std::max(-1.0, std::min(1.0, 3*q / (p*r)));
+                const double phi = std::acos(arg) / 3;
+                const double third = 2.0943951023931955; // 2 pi / 3
+                for (int k = 0; k < 3; k++)
+                    roots[k] = shift + r * std::cos(phi - third*k);
+                return 3;
+            }
+
+            // one real root (Cardano)
+            const double sq = std::sqrt(std::max(disc, 0.0));
+            roots[0] = shift + std::cbrt(-q/2 + sq) + std::cbrt(-q/2 - sq);
+            return 1;
+        }
+
+        // Unit null vector of m - lambda I, from the longest cross product of two of its rows
+        inline void eigenvector(const Mat3& m, double lambda, double* v)
+        {
+            double r[3][3];
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 3; j++)
+                    r[i][j] = m[i][j] - (i == j ? lambda : 0);
+
+            double best = 0;
+            v[0] = v[1] = v[2] = 0;
+            for (int i = 0; i < 3; i++)
+            {
+                const double* u = r[i];
+                const double* w = r[(i + 1) % 3];
+                const double c[3] = {u[1]*w[2] - u[2]*w[1], u[2]*w[0] - u[0]*w[2], u[0]*w[1] - u[1]*w[0]};
+                const double len = c[0]*c[0] + c[1]*c[1] + c[2]*c[2];
+                if (len > best)
+                {
+                    best = len;
+                    std::copy(c, c + 3, v);
+                }
+            }
+            const double len = std::sqrt(best);
+            if (len > 0)
+                for (int i = 0; i < 3; i++)
+                    v[i] /= len;
+        }
+    }
+
+    // Direct least squares ellipse fit by Halir and Flusser, which splits the 6x6 generalised eigenproblem of
+    // Fitzgibbon into a 3x3 eigenproblem for the quadratic part and a linear solve for the rest. The optional weights
+    // scale the algebraic residual of each point. The conic has unit norm and A + C > 0, so the inside of the ellipse
+    // is negative. Returns false (and Conic::none()) if fewer than 5 points are given or no ellipse fits
+    template<typename P>
+    bool fitAlgebraic(const P* points, int n, Conic& conic, const float* weights = 0)
+    {
+        conic = Conic::none();
+        if (n < 5)
+            return false;
+
+        // centre and scale the points, so the fourth order sums stay well conditioned
+        double sw = 0, mx = 0, my = 0;
+        for (int i = 0; i < n; i++)
+        {
+            const double w = weights ? weights[i] : 1.0;
+            sw += w;
+            mx += w * points[i].x;
+            my += w * points[i].y;
+        }
+        if (!(sw > 0))
+            return false;
+        mx /= sw;
+        my /= sw;
+        double scale = 0;
+        for (int i = 0; i < n; i++)
+        {
+            const double w = weights ? weights[i] : 1.0;
+            scale += w * (std::abs(points[i].x - mx) + std::abs(points[i].y - my));
+        }
+        scale = scale > 0 ? scale / (2*sw) : 1;
+
+        // accumulate the scatter sums in one pass
+        double suuuu = 0, suuuv = 0, suuvv = 0, suvvv = 0, svvvv = 0,
+            suuu = 0, suuv = 0, suvv = 0, svvv = 0,
+            suu = 0, suv = 0, svv = 0, su = 0, sv = 0;
+        for (int i = 0; i < n; i++)
+        {
+            const double w = weights ? weights[i] : 1.0;
+            const double u = (points[i].x - mx) / scale, v = (points[i].y - my) / scale;
+            const double uu = w*u*u, uv = w*u*v, vv = w*v*v;
+            suuuu += uu*u*u; suuuv += uu*u*v; suuvv += uu*v*v; suvvv += uv*v*v; svvvv += vv*v*v;
+            suuu += uu*u; suuv += uu*v; suvv += vv*u; svvv += vv*v;
+            suu += uu; suv += uv; svv += vv; su += w*u; sv += w*v;
+        }
+
+        // S1 = D1'D1, S2 = D1'D2, S3 = D2'D2 with D1 = [u^2 uv v^2] and D2 = [u v 1]
+        const detail::Mat3 S1 = {{suuuu, suuuv, suuvv}, {suuuv, suuvv, suvvv}, {suuvv, suvvv, svvvv}};
+        const detail::Mat3 S2 = {{suuu, suuv, suu}, {suuv, suvv, suv}, {suvv, svvv, svv}};
+        const detail::Mat3 S3 = {{suu, suv, su}, {suv, svv, sv}, {su, sv, sw}};
+
+        // the linear part follows from the quadratic part as a2 = T a1 (S3 is singular for collinear points)
+        detail::Mat3 S3inv, S2t, T;
+        if (!detail::inverse(S3, S3inv, 1e-12 * sw*sw*sw))
+            return false;
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                S2t[i][j] = -S2[j][i];
+        detail::mul(S3inv, S2t, T);
+
+        // reduced scatter matrix, premultiplied by the inverse of the constraint matrix C1 = [0 0 2; 0 -1 0; 2 0 0]
+        detail::Mat3 S2T, M;
+        detail::mul(S2, T, S2T);
+        for (int j = 0; j < 3; j++)
+        {
+            M[0][j] = (S1[2][j] + S2T[2][j]) / 2;
+            M[1][j] = -(S1[1][j] + S2T[1][j]);
+            M[2][j] = (S1[0][j] + S2T[0][j]) / 2;
+        }
+
+        // the ellipse is the eigenvector that satisfies the constraint 4ac - b^2 > 0
+        double roots[3], a1[3] = {0, 0, 0}, bestCond = 0;
+        const int count = detail::eigenvalues(M, roots);
+        for (int k = 0; k < count; k++)
+        {
+            double e[3];
+            detail::eigenvector(M, roots[k], e);
+            const double cond = 4*e[0]*e[2] - e[1]*e[1];
+            if (cond > bestCond)
+            {
+                bestCond = cond;
+                std::copy(e, e + 3, a1);
+            }
+        }
+        if (!(bestCond > 0))
+            return false;
+        double a2[3];
+        for (int i = 0; i < 3; i++)
+            a2[i] = T[i][0]*a1[0] + T[i][1]*a1[1] + T[i][2]*a1[2];
+
+        // undo the centring and scaling
+        const double s2 = scale*scale;
+        const double A = a1[0] / s2, B = a1[1] / s2, C = a1[2] / s2;
+        const double D = a2[0] / scale, E = a2[1] / scale, F = a2[2];
+        double coeffs[6] = {A, B, C,
+            D - 2*A*mx - B*my,
+            E - B*mx - 2*C*my,
+            F + A*mx*mx + B*mx*my + C*my*my - (D*mx + E*my)};
+
+        double norm = 0;
+        for (int i = 0; i < 6; i++)
+            norm += coeffs[i]*coeffs[i];
+        norm = std::sqrt(norm);
+        if (A + C < 0)
+            norm = -norm;
+        if (!(norm != 0))
+            return false;
+
+        conic.A = float(coeffs[0] / norm);
+        conic.B = float(coeffs[1] / norm);
+        conic.C = float(coeffs[2] / norm);
+        conic.D = float(coeffs[3] / norm);
+        conic.E = float(coeffs[4] / norm);
+        conic.F = float(coeffs[5] / norm);
+        return true;
+    }
+
+    // --------------------------------------------------------------------------------------------------------------
+    // Residual kernels
+    // --------------------------------------------------------------------------------------------------------------
+
+    inline float algebraicDistance(const Conic& q, float x, float y)
+    {
+        return (q.A*x + q.B*y + q.D)*x + (q.C*y + q.E)*y + q.F;
+    }
+
+    // Sampson distance: the algebraic distance divided by the length of the conic gradient, a first order
+    // approximation of the signed orthogonal distance. A vanishing gradient (the conic centre) is far from the curve
+    inline float sampsonDistance(const Conic& q, float x, float y)
+    {
+        const float f = algebraicDistance(q, x, y);
+        const float gx = 2*q.A*x + q.B*y + q.D;
+        const float gy = q.B*x + 2*q.C*y + q.E;
+        return f / std::sqrt(std::max(gx*gx + gy*gy, FLT_MIN));
+    }
+
+    namespace detail
+    {
+#if defined(__SSE2__)
+        // deinterleaves four x, y pairs
+        inline void load4(const float* xy, __m128& x, __m128& y)
+        {
+            const __m128 a = _mm_loadu_ps(xy);
+            const __m128 b = _mm_loadu_ps(xy + 4);
+            x = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            y = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        }
+
+        inline void load4(const int* xy, __m128& x, __m128& y)
+        {
+            const __m128 a = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(xy)));
+            const __m128 b = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(xy + 4)));
+            x = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            y = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        }
+
+        // the conic coefficients broadcast to all lanes
+        struct Conic4
+        {
+            __m128 A, B, C, D, E, F, A2, C2;
+
+            explicit Conic4(const Conic& q)
+            {
+                A = _mm_set1_ps(q.A); B = _mm_set1_ps(q.B); C = _mm_set1_ps(q.C);
+                D = _mm_set1_ps(q.D); E = _mm_set1_ps(q.E); F = _mm_set1_ps(q.F);
+                A2 = _mm_set1_ps(2*q.A); C2 = _mm_set1_ps(2*q.C);
+            }
+
+            // algebraic distance f and squared gradient length g2 of four points
+            void eval(__m128 x, __m128 y, __m128& f, __m128& g2) const
+            {
+                f = _mm_add_ps(_mm_add_ps(
+                    _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(A, x), _mm_mul_ps(B, y)), D), x),
+                    _mm_mul_ps(_mm_add_ps(_mm_mul_ps(C, y), E), y)), F);
+                const __m128 gx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(A2, x), _mm_mul_ps(B, y)), D);
+                const __m128 gy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(B, x), _mm_mul_ps(C2, y)), E);
+                g2 = _mm_max_ps(_mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy)), _mm_set1_ps(FLT_MIN));
+            }
+        };
+#endif
+
+        template<typename T>
+        void sampsonDistances(const Conic& q, const T* xy, int n, float* out)
+        {
+            int i = 0;
+#if defined(__SSE2__)
+            const Conic4 q4(q);
+            for (; i + 4 <= n; i += 4)
+            {
+                __m128 x, y, f, g2;
+                load4(xy + 2*i, x, y);
+                q4.eval(x, y, f, g2);
+                _mm_storeu_ps(out + i, _mm_div_ps(f, _mm_sqrt_ps(g2)));
+            }
+#endif
+            for (; i < n; i++)
+                out[i] = sampsonDistance(q, float(xy[2*i]), float(xy[2*i + 1]));
+        }
+
+        // |d| < t is tested as f^2 < t^2 |grad f|^2, without the square root and the division
+        template<typename T>
+        int countInliers(const Conic& q, const T* xy, int n, float threshold)
+        {
+            const float t2 = threshold * threshold;
+            int i = 0, count = 0;
+#if defined(__SSE2__)
+            const Conic4 q4(q);
+            const __m128 t24 = _mm_set1_ps(t2);
+            __m128i counts = _mm_setzero_si128();
+            for (; i + 4 <= n; i += 4)
+            {
+                __m128 x, y, f, g2;
+                load4(xy + 2*i, x, y);
+                q4.eval(x, y, f, g2);
+                const __m128 inlier = _mm_cmplt_ps(_mm_mul_ps(f, f), _mm_mul_ps(t24, g2));
+                counts = _mm_sub_epi32(counts, _mm_castps_si128(inlier));
+            }
+            int lanes[4];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), counts);
+            count = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+            for (; i < n; i++)
+            {
+                const float x = float(xy[2*i]), y = float(xy[2*i + 1]);
+                const float f = algebraicDistance(q, x, y);
+                const float gx = 2*q.A*x + q.B*y + q.D;
+                const float gy = q.B*x + 2*q.C*y + q.E;
+                count += f*f < t2 * std::max(gx*gx + gy*gy, FLT_MIN);
+            }
+            return count;
+        }
+    }
+
+    // Sampson distances of n points, given as interleaved x, y pairs
+    inline void sampsonDistances(const Conic& q, const float* xy, int n, float* out)
+    {
+        detail::sampsonDistances(q, xy, n, out);
+    }
+
+    inline void sampsonDistances(const Conic& q, const int* xy, int n, float* out)
+    {
+        detail::sampsonDistances(q, xy, n, out);
+    }
+
+    // Number of the n points with a Sampson distance below the threshold
+    inline int countInliers(const Conic& q, const float* xy, int n, float threshold)
+    {
+        return detail::countInliers(q, xy, n, threshold);
+    }
+
+    inline int countInliers(const Conic& q, const int* xy, int n, float threshold)
+    {
+        return detail::countInliers(q, xy, n, threshold);
+    }
+
+    // --------------------------------------------------------------------------------------------------------------
+    // Geometric fit
+    // --------------------------------------------------------------------------------------------------------------
+
+    // Gradient weighted fit: starting from the algebraic fit, every iteration refits with the points weighted by
+    // their inverse squared gradient length, so the fit minimises the Sampson distance rather than the algebraic
+    // distance (which favours points near the flat ends of the ellipse). The cost is a fixed number of algebraic
+    // fits. The weights are kept in workspace when one is given. Returns false if the algebraic fit fails, a
+    // failed refit keeps the previous conic
+    template<typename P>
+    bool fitGeometric(const P* points, int n, Conic& conic, int iterations = 2, std::vector<float>* workspace = 0)
+    {
+        if (!fitAlgebraic(points, n, conic))
+            return false;
+
+        std::vector<float> local;
+        std::vector<float>& weights = workspace ? *workspace : local;
+        weights.resize(n);
+        for (int k = 0; k < iterations; k++)
+        {
+            // the weights are normalised to a mean of one, so the conditioning checks stay scale free
+            double sum = 0;
+            for (int i = 0; i < n; i++)
+            {
+                const float x = float(points[i].x), y = float(points[i].y);
+                const float gx = 2*conic.A*x + conic.B*y + conic.D;
+                const float gy = conic.B*x + 2*conic.C*y + conic.E;
+                weights[i] = 1 / std::max(gx*gx + gy*gy, FLT_MIN);
+                sum += weights[i];
+            }
+            const float norm = float(n / sum);
+            for (int i = 0; i < n; i++)
+                weights[i] *= norm;
+
+            Conic refit;
+            if (!fitAlgebraic(points, n, refit, &weights[0]))
+                break;
+            conic = refit;
+        }
+        return true;
+    }
+
+}
+
+#endif // __ELLIPSE_FIT_H__
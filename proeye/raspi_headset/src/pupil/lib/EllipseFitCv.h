@@ -0,0 +1,85 @@
+#ifndef __ELLIPSE_FIT_CV_H__
+#define __ELLIPSE_FIT_CV_H__
+
+// OpenCV adapters of the ellipse fitting library: cv::RotatedRect and cv::Moments conversions, and drop-in
+// replacements for cv::fitEllipse
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "EllipseFit.h"
+
+namespace ellipse_fit
+{
+
+    inline cv::RotatedRect toRotatedRect(const Ellipse& e)
+    {
+        return cv::RotatedRect(cv::Point2f(e.cx, e.cy), cv::Size2f(e.width, e.height), e.angle);
+    }
+
+    inline Ellipse fromRotatedRect(const cv::RotatedRect& r)
+    {
+        Ellipse e = {r.center.x, r.center.y, r.size.width, r.size.height, r.angle};
+        return e;
+    }
+
+    inline Moments fromCvMoments(const cv::Moments& m)
+    {
+        Moments ret = {m.m00, m.m10, m.m01, m.m20, m.m11, m.m02};
+        return ret;
+    }
+
+    // Direct ellipse fit of at least 5 points. The few point sets that no ellipse fits (collinear points) are passed
+    // on to cv::fitEllipse, so the result is the same as before for them
+    template<typename T>
+    cv::RotatedRect fitEllipse(const cv::Point_<T>* points, int n)
+    {
+        Conic conic;
+        Ellipse e;
+        if (fitAlgebraic(points, n, conic) && ellipseFromConic(conic, e))
+            return toRotatedRect(e);
+        return cv::fitEllipse(cv::Mat(1, n, cv::DataType<cv::Point_<T> >::type, const_cast<cv::Point_<T>*>(points)));
+    }
+
+    template<typename T>
+    cv::RotatedRect fitEllipse(const std::vector<cv::Point_<T> >& points)
+    {
+        return fitEllipse(points.empty() ? 0 : &points[0], static_cast<int>(points.size()));
+    }
+
+    // Coarse ellipse of the moments of a region (see fitMoments). Returns false for empty moments (a region without
+    // area), which have no ellipse, and leaves the ellipse unchanged
+    inline bool fitEllipse(const cv::Moments& m, cv::RotatedRect& ellipse)
+    {
+        Ellipse e;
+        if (!fitMoments(fromCvMoments(m), e))
+            return false;
+        ellipse = toRotatedRect(e);
+        return true;
+    }
+
+    inline void sampsonDistances(const Conic& q, const cv::Point* points, int n, float* out)
+    {
+        sampsonDistances(q, reinterpret_cast<const int*>(points), n, out);
+    }
+
+    inline void sampsonDistances(const Conic& q, const cv::Point2f* points, int n, float* out)
+    {
+        sampsonDistances(q, reinterpret_cast<const float*>(points), n, out);
+    }
+
+    inline int countInliers(const Conic& q, const cv::Point* points, int n, float threshold)
+    {
+        return countInliers(q, reinterpret_cast<const int*>(points), n, threshold);
+    }
+
+    inline int countInliers(const Conic& q, const cv::Point2f* points, int n, float threshold)
+    {
+        return countInliers(q, reinterpret_cast<const float*>(points), n, threshold);
+    }
+
+}
+
+#endif // __ELLIPSE_FIT_CV_H__
@@ -11,6 +11,7 @@
 #include <tbb/tbb.h>
 
 #include "cvx.h"
+#include "EllipseFitCv.h"
 
 namespace
 {
@@ -91,14 +92,216 @@ cv::RotatedRect fitEllipse(const std::vector<PupilTracker::EdgePoint>& edgePoint
 	BOOST_FOREACH(const PupilTracker::EdgePoint& e, edgePoints)
 		points.push_back(e.point);
 
-	return cv::fitEllipse(points);
+	return ellipse_fit::fitEllipse(points);
 }
 
 
+// Buffers of voteEllipse, kept per thread so that they keep their capacity from frame to frame
+struct VoteBuffers
+{
+	std::vector<cv::Point2f> normals, support, trimmed;
+	std::vector<int32_t> acc, rowSums, sums;
+	std::vector<float> distances, sorted;
+};
+static tbb::enumerable_thread_specific<VoteBuffers> voteBuffers;
+
+// Deterministic alternative to RANSAC. Every edge point votes for the pupil centre along its gradient: the pupil is
+// dark, so the centre lies against the gradient, between half the minimum and the maximum radius away. The normals of
+// an ellipse only pass near its centre (they meet on its evolute), so the votes are summed over boxes of about the
+// minimum radius. The edge points that face away from the strongest centre are fit by least squares, and refit to the
+// edge points within 2px of that fit. The cost is bounded by the number of edge points times the radius range,
+// whatever the fraction of outliers.
+static bool voteEllipse(const PupilTracker::TrackerParams& params, const std::vector<cv::Point2f>& edgePoints, const cv::Rect& bb, const cv::Mat_<float>& mDX, const cv::Mat_<float>& mDY, cv::RotatedRect& ellipse, std::vector<cv::Point2f>& inliers, int& votes)
+{
+	const int rows = mDX.rows;
+	const int cols = mDX.cols;
+	const int rMin = std::max(1, params.Radius_Min / 2);
+	const int rMax = params.Radius_Max;
+	const float MIN_COS = 0.8f;
+	const float MAX_ERR = 2;
+	VoteBuffers& buffers = voteBuffers.local();
+
+	// Unit gradients of the edge points, (0,0) where there is none
+	std::vector<cv::Point2f>& normals = buffers.normals;
+	normals.resize(edgePoints.size());
+	for (size_t i = 0; i < edgePoints.size(); ++i)
+	{
+		int x = std::min(std::max(static_cast<int>(edgePoints[i].x), 0), cols - 1);
+		int y = std::min(std::max(static_cast<int>(edgePoints[i].y), 0), rows - 1);
+		cv::Point2f g(mDX(y, x), mDY(y, x));
+		float len = std::sqrt(g.dot(g));
+		normals[i] = len > 0 ? g * (1 / len) : cv::Point2f(0, 0);
+	}
+
+	// Vote into an integer accumulator with a K cell border, so the box sums need no bounds checks. A ray that
+	// leaves the region never re-enters it
+	const int K = std::max(1, params.Radius_Min / 2);
+	buffers.acc.assign((rows + 2 * K) * (cols + 2 * K), 0);
+	cv::Mat_<int32_t> acc(rows + 2 * K, cols + 2 * K, &buffers.acc[0]);
+	for (size_t i = 0; i < edgePoints.size(); ++i)
+	{
+		const cv::Point2f& p = edgePoints[i];
+		const cv::Point2f& d = normals[i];
+		if (d.x == 0 && d.y == 0)
+			continue;
+
+		for (int r = rMin; r <= rMax; ++r)
+		{
+			int x = cvFloor(p.x - r * d.x);
+			int y = cvFloor(p.y - r * d.y);
+			if (static_cast<unsigned>(x) >= static_cast<unsigned>(cols) || static_cast<unsigned>(y) >= static_cast<unsigned>(rows))
+				break;
+			acc(y + K, x + K)++;
+		}
+	}
+
+	// Sum the votes over (2K+1)x(2K+1) boxes with running sums, along the rows and then down the columns, so the
+	// cost does not depend on the box size
+	buffers.rowSums.resize((rows + 2 * K) * cols);
+	cv::Mat_<int32_t> rowSums(rows + 2 * K, cols, &buffers.rowSums[0]);
+	for (int y = 0; y < rows + 2 * K; ++y)
+	{
+		const int32_t* a = acc[y];
+		int32_t* s = rowSums[y];
+		int32_t sum = 0;
+		for (int k = 0; k < 2 * K; ++k)
+			sum += a[k];
+		for (int x = 0; x < cols; ++x)
+		{
+			sum += a[x + 2 * K];
+			s[x] = sum;
+			sum -= a[x];
+		}
+	}
+	buffers.sums.assign(rows * cols, 0);
+	cv::Mat_<int32_t> sums(rows, cols, &buffers.sums[0]);
+	for (int k = 0; k <= 2 * K; ++k)
+	{
+		const int32_t* r = rowSums[k];
+		int32_t* s = sums[0];
+		for (int x = 0; x < cols; ++x)
+			s[x] += r[x];
+	}
+	for (int y = 1; y < rows; ++y)
+	{
+		const int32_t* above = sums[y - 1];
+		const int32_t* entering = rowSums[y + 2 * K];
+		const int32_t* leaving = rowSums[y - 1];
+		int32_t* s = sums[y];
+		for (int x = 0; x < cols; ++x)
+			s[x] = above[x] + entering[x] - leaving[x];
+	}
+
+	double maxVotes = 0;
+	cv::Point maxLoc;
+	cv::minMaxLoc(sums, 0, &maxVotes, 0, &maxLoc);
+	votes = static_cast<int>(maxVotes);
+	if (votes == 0)
+		return false;
+	cv::Point2f centre(maxLoc.x + 0.5f, maxLoc.y + 0.5f);
+
+	// The normals of an eccentric ellipse miss its centre, so the support is selected twice: around the voted
+	// centre, and around the centre of the first fit
+	ellipse_fit::Conic conic;
+	std::vector<cv::Point2f>& support = buffers.support;
+	std::vector<cv::Point2f>& trimmed = buffers.trimmed;
+	std::vector<float>& distances = buffers.distances;
+	std::vector<float>& sorted = buffers.sorted;
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		// The edge points in range that face away from the centre
+		support.clear();
+		for (size_t i = 0; i < edgePoints.size(); ++i)
+		{
+			cv::Point2f v = edgePoints[i] - centre;
+			float dist = std::sqrt(v.dot(v));
+			if (dist < rMin || dist > rMax)
+				continue;
+			if (normals[i].dot(v) > MIN_COS * dist)
+				support.push_back(edgePoints[i]);
+		}
+		if (support.size() < 5 || !ellipse_fit::fitAlgebraic(&support[0], static_cast<int>(support.size()), conic))
+			return false;
+
+		// Outliers that happen to face away from the centre pull the fit, so it is trimmed a few times to the
+		// support points within twice the median distance
+		for (int iteration = 0; iteration < 3; ++iteration)
+		{
+			distances.resize(support.size());
+			ellipse_fit::sampsonDistances(conic, &support[0], static_cast<int>(support.size()), &distances[0]);
+			for (size_t i = 0; i < distances.size(); ++i)
+				distances[i] = std::abs(distances[i]);
+			sorted.assign(distances.begin(), distances.end());
+			std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+			const float threshold = std::max(MAX_ERR, 2 * sorted[sorted.size() / 2]);
+
+			trimmed.clear();
+			for (size_t i = 0; i < support.size(); ++i)
+			{
+				if (distances[i] < threshold)
+					trimmed.push_back(support[i]);
+			}
+			if (trimmed.size() == support.size() || trimmed.size() < 5
+				|| !ellipse_fit::fitAlgebraic(&trimmed[0], static_cast<int>(trimmed.size()), conic))
+				break;
+			support.swap(trimmed);
+		}
+
+		ellipse_fit::Ellipse e;
+		if (!ellipse_fit::ellipseFromConic(conic, e))
+			return false;
+		centre = cv::Point2f(e.cx, e.cy);
+	}
+
+	// Refit to every edge point within 2px of the fit
+	inliers.clear();
+	distances.resize(edgePoints.size());
+	ellipse_fit::sampsonDistances(conic, &edgePoints[0], static_cast<int>(edgePoints.size()), &distances[0]);
+	for (size_t i = 0; i < edgePoints.size(); ++i)
+	{
+		if (std::abs(distances[i]) < MAX_ERR)
+			inliers.push_back(edgePoints[i]);
+	}
+	ellipse_fit::Conic refit;
+	if (inliers.size() >= 5 && ellipse_fit::fitGeometric(&inliers[0], static_cast<int>(inliers.size()), refit))
+		conic = refit;
+
+	ellipse_fit::Ellipse e;
+	if (!ellipse_fit::ellipseFromConic(conic, e))
+		return false;
+	ellipse = ellipse_fit::toRotatedRect(e);
+
+	// Normalise ellipse to have width as the major axis, and discard it by the same bounds as RANSAC
+	if (ellipse.size.height > ellipse.size.width)
+	{
+		ellipse.angle = std::fmod(ellipse.angle + 90, 180);
+		std::swap(ellipse.size.height, ellipse.size.width);
+	}
+	cv::Size s = ellipse.size;
+	return ellipse.center.inside(bb)
+		&& s.height <= params.Radius_Max * 2
+		&& s.width <= params.Radius_Max * 2
+		&& (s.height >= params.Radius_Min * 2 || s.width >= params.Radius_Min * 2)
+		&& s.height <= 4 * s.width
+		&& s.width <= 4 * s.height;
+}
+
 bool PupilTracker::findPupilEllipse(
 	const TrackerParams& params,
 	const cv::Mat& m,
 
+	PupilTracker::findPupilEllipse_out& out,
+	tracker_log& log
+	)
+{
+	return findPupilEllipse(params, m, cv::RotatedRect(), out, log);
+}
+
+bool PupilTracker::findPupilEllipse(
+	const TrackerParams& params,
+	const cv::Mat& m,
+	const cv::RotatedRect& seed,
+
 	PupilTracker::findPupilEllipse_out& out,
 	tracker_log& log
 	)
@@ -152,29 +355,38 @@ bool PupilTracker::findPupilEllipse(
 	// |_________________________|
 	//
 
+	// A seed (such as a rejected Canny ellipse) gives the pupil position and size, so the Haar search is skipped
+	const bool seeded = seed.size.width > 0 && seed.size.height > 0;
+
 	cv::Mat_<int32_t> mEyeIntegral;
 	int padding = 2*params.Radius_Max;
 
 	SECTION("Integral image", log)
 	{
-		cv::Mat mEyePad;
-		// Need to pad by an additional 1 to get bottom & right edges.
-		cv::copyMakeBorder(mEye, mEyePad, padding, padding, padding, padding, cv::BORDER_REPLICATE);
-		cv::integral(mEyePad, mEyeIntegral);
+		// Sum the image as if it were padded by replicating its border, without building the padded copy
+		if (!seeded)
+			cvx::integralReplicate(mEye, mEyeIntegral, padding);
 	}
 
 	cv::Point2f pHaarPupil;
 	int haarRadius;
 
+	if (seeded)
+	{
+		pHaarPupil = seed.center;
+		haarRadius = cvRound(std::max(seed.size.width, seed.size.height) / 2);
+		haarRadius = std::min(std::max(haarRadius, params.Radius_Min), params.Radius_Max);
+	}
+
 	SECTION("Haar responses", log)
 	{
 		const int rstep = 2;
-		const int ystep = 4;
-		const int xstep = 4;
+		const int ystep = std::max(1, params.HaarStride);
+		const int xstep = std::max(1, params.HaarStride);
 
 		double minResponse = std::numeric_limits<double>::infinity();
 
-		for (int r = params.Radius_Min; r < params.Radius_Max; r+=rstep)
+		for (int r = params.Radius_Min; !seeded && r < params.Radius_Max; r+=rstep)
 		{
 			// Get Haar feature
 			int r_inner = r;
@@ -369,7 +581,11 @@ bool PupilTracker::findPupilEllipse(
 		cv::Moments momentsPupilThresh = cv::moments(maxContour);
 
 		bbPupilThresh = cv::boundingRect(maxContour);
-		elPupilThresh = cvx::fitEllipse(momentsPupilThresh);
+		// return if the best region has no area, so has no ellipse
+		if (!cvx::fitEllipse(momentsPupilThresh, elPupilThresh))
+		{
+			return false;
+		}
 
 		// Shift best region into eye coords (instead of pupil region coords), and get ROI
 		bbPupilThresh.x += roiHaarPupil.x;
@@ -531,6 +747,19 @@ bool PupilTracker::findPupilEllipse(
 	}
 
 
+	// Keep within the edge point budget by taking evenly spaced points
+	if (params.MaxEdgePoints > 0 && edgePoints.size() > static_cast<size_t>(params.MaxEdgePoints))
+	{
+		SECTION("Edge budget", log)
+		{
+			double edgeStep = static_cast<double>(edgePoints.size()) / params.MaxEdgePoints;
+			for (int i = 0; i < params.MaxEdgePoints; ++i)
+				edgePoints[i] = edgePoints[static_cast<size_t>(i*edgeStep)];
+			edgePoints.resize(params.MaxEdgePoints);
+		}
+	}
+
+
 	// ---------------------------
 	// Fit an ellipse to the edges
 	// ---------------------------
@@ -546,16 +775,49 @@ bool PupilTracker::findPupilEllipse(
 		// Number of points needed for a model
 		const int n = 5;
 
-		if (params.PercentageInliers == 0)
-			return false;
+		if (params.Fitter == FITTER_VOTING)
+		{
+			// Gradient voting, which is deterministic and has a bounded cost
+			out.ransacIterations = 0;
+			out.earlyRejections = 0;
+			out.earlyTermination = false;
+
+			int votes = 0;
+			cv::RotatedRect ellipseVoteFit;
+			if (edgePoints.size() >= n && voteEllipse(params, edgePoints, bbPupil, out.mPupilSobelX, out.mPupilSobelY, ellipseVoteFit, inliers, votes))
+			{
+				ConicSection conicVoteFit(ellipseVoteFit);
+				BOOST_FOREACH(const cv::Point2f& p, edgePoints)
+				{
+					cv::Point2f grad = conicVoteFit.algebraicGradientDir(p);
+					float dx = out.mPupilSobelX(p);
+					float dy = out.mPupilSobelY(p);
+
+					out.edgePoints.push_back(EdgePoint(p, dx*grad.x + dy*grad.y));
+				}
 
-		if (edgePoints.size() >= n) // Minimum points for ellipse
+				elPupil = ellipseVoteFit;
+				elPupil.center.x += roiPupil.x;
+				elPupil.center.y += roiPupil.y;
+			}
+			else
+			{
+				inliers.clear();
+			}
+			log.add("votes", votes);
+		}
+		else if (params.PercentageInliers == 0)
+			return false;
+		else if (edgePoints.size() >= n) // Minimum points for ellipse
 		{
 			// RANSAC!!!
 
 			double wToN = std::pow(w,n);
 			int k = static_cast<int>(std::log(1-p)/std::log(1 - wToN)  + 2*std::sqrt(1 - wToN)/wToN);
 
+			if (params.MaxRansacIterations > 0)
+				k = std::min(k, params.MaxRansacIterations);
+
 			out.ransacIterations = k;
 
 			log.add("k", k);
@@ -605,6 +867,9 @@ bool PupilTracker::findPupilEllipse(
 				{
 					if (out.earlyTermination)
 						return;
+
+					// Sampson distances of the edge points, reused by the iterations of the range
+					std::vector<float> distances;
 					//std::cout << "Ransac start (" << (r.end()-r.begin()) << " elements)" << std::endl;
 					for( size_t i=r.begin(); i!=r.end(); ++i )
 					{
@@ -616,7 +881,7 @@ bool PupilTracker::findPupilEllipse(
 						else
 							sample = randomSubset(edgePoints, n);
 
-						cv::RotatedRect ellipseSampleFit = fitEllipse(sample);
+						cv::RotatedRect ellipseSampleFit = ellipse_fit::fitEllipse(sample);
 						// Normalise ellipse to have width as the major axis.
 						if (ellipseSampleFit.size.height > ellipseSampleFit.size.width)
 						{
@@ -668,24 +933,26 @@ bool PupilTracker::findPupilEllipse(
 						ConicSection conicInlierFit = conicSampleFit;
 						std::vector<cv::Point2f> inliers, prevInliers;
 
+						// Inliers are the edge points within MAX_ERR pixels of the ellipse, by their Sampson distance
+						const float MAX_ERR = 2;
+						const int numEdgePoints = static_cast<int>(edgePoints.size());
+						ellipse_fit::Conic conicInliers = ellipse_fit::conicFromEllipse(ellipse_fit::fromRotatedRect(ellipseInlierFit));
+
+						// Most samples have too few inliers to be refitted, so they are counted before any is collected
+						if (ellipse_fit::countInliers(conicInliers, &edgePoints[0], numEdgePoints, MAX_ERR) < n)
+							continue;
+
 						// Iteratively find inliers, and re-fit the ellipse
 						for (int i = 0; i < params.InlierIterations; ++i)
 						{
-							// Get error scale for 1px out on the minor axis
-							cv::Point2f minorAxis(-std::sin(PI/180.0*ellipseInlierFit.angle), std::cos(PI/180.0*ellipseInlierFit.angle));
-							cv::Point2f minorAxisPlus1px = ellipseInlierFit.center + (ellipseInlierFit.size.height/2 + 1)*minorAxis;
-							float errOf1px = conicInlierFit.distance(minorAxisPlus1px);
-							float errorScale = 1.0f/errOf1px;
-
 							// Find inliers
+							distances.resize(edgePoints.size());
+							ellipse_fit::sampsonDistances(conicInliers, &edgePoints[0], numEdgePoints, &distances[0]);
 							inliers.reserve(edgePoints.size());
-							const float MAX_ERR = 2;
-							BOOST_FOREACH(const cv::Point2f& p, edgePoints)
+							for (int j = 0; j < numEdgePoints; ++j)
 							{
-								float err = errorScale*conicInlierFit.distance(p);
-
-								if (err*err < MAX_ERR*MAX_ERR)
-									inliers.push_back(p);
+								if (std::abs(distances[j]) < MAX_ERR)
+									inliers.push_back(edgePoints[j]);
 							}
 
 							if (inliers.size() < n) {
@@ -694,8 +961,9 @@ bool PupilTracker::findPupilEllipse(
 							}
 
 							// Refit ellipse to inliers
-							ellipseInlierFit = fitEllipse(inliers);
+							ellipseInlierFit = ellipse_fit::fitEllipse(inliers);
 							conicInlierFit = ConicSection(ellipseInlierFit);
+							conicInliers = ellipse_fit::conicFromEllipse(ellipse_fit::fromRotatedRect(ellipseInlierFit));
 
 							// Normalise ellipse to have width as the major axis.
 							if (ellipseInlierFit.size.height > ellipseInlierFit.size.width)
@@ -765,7 +1033,7 @@ bool PupilTracker::findPupilEllipse(
 			EllipseRansac ransac(params, edgePoints, n, bbPupil, out.mPupilSobelX, out.mPupilSobelY);
 			try
 			{
-				tbb::parallel_reduce(tbb::blocked_range<size_t>(0,k,k/8), ransac);
+				tbb::parallel_reduce(tbb::blocked_range<size_t>(0,k,std::max(1,k/8)), ransac);
 			}
 			catch (std::exception& e)
 			{
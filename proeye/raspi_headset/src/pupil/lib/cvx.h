@@ -1,8 +1,15 @@
 #ifndef __CVX_H__
 #define __CVX_H__
 
+#include <algorithm>
+
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "utils.h"
 
@@ -12,6 +19,16 @@ const double PI = CV_PI;
 namespace cvx
 {
 
+	// Pixel layouts of the camera buffers that the trackers accept
+	enum PixelFormat
+	{
+		PIXEL_FORMAT_MONO8,
+		PIXEL_FORMAT_YUYV,
+		PIXEL_FORMAT_UYVY,
+		PIXEL_FORMAT_NV12,
+		PIXEL_FORMAT_BGR8
+	};
+
 	template<typename T>
 	inline cv::Rect_<T> roiAround(T x, T y, T radius)
 	{
@@ -41,13 +58,92 @@ namespace cvx
 		return cv::Rect(0,0,img.cols,img.rows);
 	}
 
+	// Bounding box of the non-zero pixels of an 8 bit mask, found in a single row-major pass. Every row is OR-ed
+	// 32 bytes at a time into a column accumulator, which gives the x-range, and into a row total, which gives the
+	// y-range. Returns false if the mask is empty.
+	inline bool nonZeroBounds(const cv::Mat& mask, cv::Rect& bounds)
+	{
+		CV_Assert(mask.type() == CV_8UC1);
+
+		const int cols = mask.cols;
+		cv::AutoBuffer<uchar> columnsBuffer(cols + 1);
+		uchar* columns = columnsBuffer;
+		std::fill(columns, columns + cols, 0);
+
+		int yMin = -1, yMax = -1;
+		for (int y = 0; y < mask.rows; y++)
+		{
+			const uchar* row = mask.ptr<uchar>(y);
+			bool rowSet = false;
+			int x = 0;
+#if defined(__AVX2__)
+			__m256i rowOr = _mm256_setzero_si256();
+			for (; x + 32 <= cols; x += 32)
+			{
+				__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x));
+				__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(columns + x));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(columns + x), _mm256_or_si256(c, v));
+				rowOr = _mm256_or_si256(rowOr, v);
+			}
+			rowSet = !_mm256_testz_si256(rowOr, rowOr);
+#elif defined(__SSE2__)
+			__m128i rowOr = _mm_setzero_si128();
+			for (; x + 32 <= cols; x += 32)
+			{
+				__m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+				__m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x + 16));
+				__m128i c0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(columns + x));
+				__m128i c1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(columns + x + 16));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(columns + x), _mm_or_si128(c0, v0));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(columns + x + 16), _mm_or_si128(c1, v1));
+				rowOr = _mm_or_si128(rowOr, _mm_or_si128(v0, v1));
+			}
+			rowSet = _mm_movemask_epi8(_mm_cmpeq_epi8(rowOr, _mm_setzero_si128())) != 0xFFFF;
+#endif
+			uchar rowTail = 0;
+			for (; x < cols; x++)
+			{
+				columns[x] |= row[x];
+				rowTail |= row[x];
+			}
+
+			if (rowSet || rowTail)
+			{
+				if (yMin < 0)
+					yMin = y;
+				yMax = y;
+			}
+		}
+
+		if (yMin < 0)
+			return false;
+
+		int xMin = 0, xMax = cols - 1;
+		while (columns[xMin] == 0)
+			xMin++;
+		while (columns[xMax] == 0)
+			xMax--;
+
+		bounds = cv::Rect(xMin, yMin, xMax - xMin + 1, yMax - yMin + 1);
+		return true;
+	}
+
 	void getROI(const cv::Mat& src, cv::Mat& dst, const cv::Rect& roi, int borderType = cv::BORDER_REPLICATE);
 
 	float histKmeans(const cv::Mat_<float>& hist, int bin_min, int bin_max, int K, float init_centres[], cv::Mat_<uchar>& labels, cv::TermCriteria termCriteria);
 
-	cv::RotatedRect fitEllipse(const cv::Moments& m);
+	bool fitEllipse(const cv::Moments& m, cv::RotatedRect& ellipse);
 	cv::Vec2f majorAxis(const cv::RotatedRect& ellipse);
 
+	// Integral image of src as if it had been padded with BORDER_REPLICATE on every side. Gives the same
+	// result as copyMakeBorder followed by cv::integral, without building the padded copy of the image.
+	void integralReplicate(const cv::Mat_<uchar>& src, cv::Mat_<int32_t>& dst, int padding);
+
+	// Gets the luma plane of a camera buffer as a single channel image. Mono8 and NV12 buffers are wrapped
+	// without copying. Packed 4:2:2 and BGR buffers need their Y values gathered, which is done into buffer so
+	// its storage is reused from frame to frame; the returned image then points into buffer.
+	cv::Mat lumaPlane(const uchar* data, int width, int height, size_t step, PixelFormat format, cv::Mat& buffer);
+
 
 
 
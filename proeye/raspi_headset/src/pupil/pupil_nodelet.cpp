@@ -0,0 +1,125 @@
+/*******************************************************************************************************************//**
+ * @FILE pupil_nodelet.cpp
+ * @BRIEF ROS nodelet wrapper of the Robust Pupil Tracker by Lech Swirski
+ *
+ * Runs the pupil tracker inside a nodelet manager, so that images published by a camera nodelet in the same manager
+ * are handed over by pointer instead of being serialised and copied. Tracking results are published as compact
+ * raspi_headset/PupilEllipse messages.
+ **********************************************************************************************************************/
+
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+
+#include <ros/ros.h>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include <image_transport/image_transport.h>
+
+#include <raspi_headset/PupilEllipse.h>
+
+#include "lib/PupilTracker.h"
+#include "pupil_tracking.h"
+
+namespace raspi_headset
+{
+
+/*******************************************************************************************************************//**
+ * @CLASS PupilTrackerNodelet
+ * @BRIEF nodelet that tracks the pupil in each image of an eye camera stream
+ **********************************************************************************************************************/
+class PupilTrackerNodelet : public nodelet::Nodelet
+{
+public:
+
+    virtual void onInit();
+
+private:
+
+    void imageCallback(const sensor_msgs::ImageConstPtr& msg);
+
+    boost::shared_ptr<image_transport::ImageTransport> m_imageTransport;
+    image_transport::Subscriber m_imageSubscriber;
+    ros::Publisher m_pupilPublisher;
+
+    PupilTracker::TrackerParams m_params;
+    cv::Mat m_lumaBuffer;
+};
+
+/*******************************************************************************************************************//**
+ * @BRIEF initializes the nodelet
+ *
+ * Reads the tracking parameters and connects the image subscriber and result publisher
+ **********************************************************************************************************************/
+void PupilTrackerNodelet::onInit()
+{
+    ros::NodeHandle& nh = getNodeHandle();
+    ros::NodeHandle& pnh = getPrivateNodeHandle();
+
+    // obtain parameters
+    std::string topic;
+    pnh.param<std::string>("topic", topic, "/camera/image");
+    pnh.param("min_radius", m_params.Radius_Min, 10);
+    pnh.param("max_radius", m_params.Radius_Max, 60);
+    pnh.param("canny_blur", m_params.CannyBlur, 1.6);
+    pnh.param("canny_thresh_1", m_params.CannyThreshold1, 30.0);
+    pnh.param("canny_thresh_2", m_params.CannyThreshold2, 50.0);
+    pnh.param("starburst_points", m_params.StarburstPoints, 0);
+    pnh.param("percent_inliers", m_params.PercentageInliers, 40);
+    pnh.param("inlier_iterations", m_params.InlierIterations, 2);
+    pnh.param("image_aware_support", m_params.ImageAwareSupport, true);
+    pnh.param("early_termination_percentage", m_params.EarlyTerminationPercentage, 95);
+    pnh.param("early_rejection", m_params.EarlyRejection, true);
+    pnh.param("seed", m_params.Seed, -1);
+    bool votingFitter;
+    pnh.param("voting_fitter", votingFitter, false);
+    m_params.Fitter = votingFitter ? PupilTracker::FITTER_VOTING : PupilTracker::FITTER_RANSAC;
+
+    // publish the tracking results
+    m_pupilPublisher = pnh.advertise<raspi_headset::PupilEllipse>("pupil", 1);
+
+    // subscribe to the raw image stream, which is passed by pointer when the publisher shares our manager
+    m_imageTransport.reset(new image_transport::ImageTransport(nh));
+    m_imageSubscriber = m_imageTransport->subscribe(topic, 1, &PupilTrackerNodelet::imageCallback, this, image_transport::TransportHints("raw"));
+}
+
+/*******************************************************************************************************************//**
+ * @BRIEF callback function for incoming video occulography images
+ *
+ * Tracks the pupil in the shared image and publishes the resulting ellipse
+ *
+ * @PARAM[in] msg input image message
+ **********************************************************************************************************************/
+void PupilTrackerNodelet::imageCallback(const sensor_msgs::ImageConstPtr& msg)
+{
+    const ros::Time received = ros::Time::now();
+
+    // get the grayscale image, sharing the message data where possible
+    cv::Mat lumaImage;
+    if(!getLumaImage(msg, m_lumaBuffer, lumaImage))
+    {
+        return;
+    }
+
+    // perform the ellipse fitting
+    PupilTracker::findPupilEllipse_out result;
+    tracker_log log;
+    const bool success = PupilTracker::findPupilEllipse(m_params, lumaImage, result, log);
+
+    // package and publish the result
+    raspi_headset::PupilEllipsePtr pupil(new raspi_headset::PupilEllipse);
+    pupil->header = msg->header;
+    pupil->center_x = result.elPupil.center.x;
+    pupil->center_y = result.elPupil.center.y;
+    pupil->major_axis = std::max(result.elPupil.size.width, result.elPupil.size.height);
+    pupil->minor_axis = std::min(result.elPupil.size.width, result.elPupil.size.height);
+    pupil->angle = result.elPupil.angle;
+    pupil->confidence = success ? getPupilConfidence(result) : 0.0f;
+    pupil->received = received;
+    pupil->processing_time = ros::Time::now() - received;
+    m_pupilPublisher.publish(pupil);
+}
+
+} // namespace raspi_headset
+
+PLUGINLIB_EXPORT_CLASS(raspi_headset::PupilTrackerNodelet, nodelet::Nodelet)
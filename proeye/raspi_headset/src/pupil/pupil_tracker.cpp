@@ -14,9 +14,13 @@
 #include <sensor_msgs/image_encodings.h>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <tbb/task_scheduler_init.h>
 
 #include "lib/PupilTracker.h"
 #include "lib/cvx.h"
+#include "pupil_tracking.h"
+#include "frame_mailbox.h"
+#include "quality_scheduler.h"
 
 // camera parameters
 #define CAMERA_FRAME_WIDTH 640
@@ -35,6 +39,7 @@
 #define EARLY_TERMINATION_PERCENTAGE 95
 #define EARLY_REJECTION true
 #define SEED_VALUE -1
+#define ELLIPSE_FITTER PupilTracker::FITTER_RANSAC
 
 // define color constants for image annotation
 const CvScalar COLOR_WHITE = CV_RGB(255, 255, 255);
@@ -64,10 +69,32 @@ std::string SUBSCRIBE_TOPIC_NAME = "/camera/image";
 
 // define node settings
 bool DISPLAY_RESULT = true;
+double MAX_FRAME_AGE = 0.1;
+int STATISTICS_FRAMES = 90;
+
+// latest frame hand-off from the spinner thread to the tracking thread
+FrameMailbox frameMailbox;
+
+// tracker quality scaling to meet the frame deadline (disabled when NULL)
+QualityScheduler* qualityScheduler = NULL;
+
+// define a struct to hold per-frame queue latency statistics
+struct QueueStatistics
+{
+    QueueStatistics() : processed(0), stale(0), latencySum(0), latencyMax(0)
+    {
+    }
+
+    unsigned int processed;
+    unsigned int stale;
+    double latencySum;
+    double latencyMax;
+};
 
 // function prototypes
-void processImage(cv::Mat &m, TrackingData &result);
-void imageCallback();
+void processImage(const cv::Mat &imageIn, PupilTracker::findPupilEllipse_out &trackingResult);
+void processFrame(const sensor_msgs::ImageConstPtr& msg);
+void imageCallback(const sensor_msgs::ImageConstPtr& msg);
 
 /*******************************************************************************************************************//**
  * @BRIEF wrapper function for Roboust Pupil Tracker
@@ -78,7 +105,7 @@ void imageCallback();
  * @PARAM[out] trackingResult the resulting tracking result metadata
  * @AUTHOR Christopher D. McMurrough
  **********************************************************************************************************************/
-void processImage(cv::Mat &imageIn, PupilTracker::findPupilEllipse_out &trackingResult)
+void processImage(const cv::Mat &imageIn, PupilTracker::findPupilEllipse_out &trackingResult)
 {
     // set the tracking parameters for this frame
     PupilTracker::TrackerParams params;
@@ -94,45 +121,57 @@ void processImage(cv::Mat &imageIn, PupilTracker::findPupilEllipse_out &tracking
     params.EarlyTerminationPercentage = EARLY_TERMINATION_PERCENTAGE;
     params.EarlyRejection = EARLY_REJECTION;
     params.Seed = SEED_VALUE;
+    params.Fitter = ELLIPSE_FITTER;
+
+    // lower the tracking quality as needed to meet the frame deadline
+    if(qualityScheduler != NULL)
+    {
+        qualityScheduler->apply(params);
+    }
 
     // perform the ellipse fitting
     tracker_log log;
+    ros::WallTime start = ros::WallTime::now();
     PupilTracker::findPupilEllipse(params, imageIn, trackingResult, log);
+
+    // measure the frame time for the quality scheduler
+    if(qualityScheduler != NULL)
+    {
+        qualityScheduler->addFrame((ros::WallTime::now() - start).toSec() * 1000.0, log);
+    }
 }
 
 /*******************************************************************************************************************//**
- * @BRIEF callback function for incoming video occulography images
+ * @BRIEF tracks the pupil in a single video occulography image
  *
- * Handles image processing and display of annotated results
+ * Handles image processing and display of annotated results. Runs on the tracking thread only.
  *
  * @PARAM[in] msg input image message
  * @AUTHOR Christopher D. McMurrough
  **********************************************************************************************************************/
-void imageCallback(const sensor_msgs::ImageConstPtr& msg)
+void processFrame(const sensor_msgs::ImageConstPtr& msg)
 {
-    cv_bridge::CvImagePtr cvPtr;
+    static cv::Mat lumaBuffer;
+    cv::Mat lumaImage;
     PupilTracker::findPupilEllipse_out pupilResult;
 
-    // attempt to convert the image message to an openCV structure
-    try
-    {
-        cvPtr = cv_bridge::toCvCopy(msg, sensor_msgs::image_encodings::BGR8);
-    }
-    catch (cv_bridge::Exception &e)
+    // get the grayscale image, sharing the message data where possible
+    if(!getLumaImage(msg, lumaBuffer, lumaImage))
     {
-        ROS_ERROR("cv_bridge exception: %s", e.what());
         return;
     }
 
     // process the image
-    processImage(cvPtr->image, pupilResult);
+    processImage(lumaImage, pupilResult);
 
-    // display the annotated result image if necessary
+    // display the annotated result image if necessary (the luma image may belong to the message, so draw on a copy)
     if(DISPLAY_RESULT)
     {
-        cvx::cross(cvPtr->image, pupilResult.pPupil, 5, COLOR_RED);
-        cv::ellipse(cvPtr->image, pupilResult.elPupil, COLOR_GREEN);
-        cv::imshow(DISPLAY_WINDOW_NAME, cvPtr->image);
+        cv::Mat displayImage;
+        cv::cvtColor(lumaImage, displayImage, CV_GRAY2BGR);
+        cvx::cross(displayImage, pupilResult.pPupil, 5, COLOR_RED);
+        cv::ellipse(displayImage, pupilResult.elPupil, COLOR_GREEN);
+        cv::imshow(DISPLAY_WINDOW_NAME, displayImage);
         cv::waitKey(1);
     }
 
@@ -155,6 +194,19 @@ void imageCallback(const sensor_msgs::ImageConstPtr& msg)
     //m_imagePublisher.publish(cvPtr->toImageMsg());
 }
 
+/*******************************************************************************************************************//**
+ * @BRIEF callback function for incoming video occulography images
+ *
+ * Runs on the spinner thread and only hands the frame to the tracking thread, replacing any frame still waiting
+ *
+ * @PARAM[in] msg input image message
+ * @AUTHOR Christopher D. McMurrough
+ **********************************************************************************************************************/
+void imageCallback(const sensor_msgs::ImageConstPtr& msg)
+{
+    frameMailbox.post(msg);
+}
+
 /*******************************************************************************************************************//**
  * @BRIEF program entry point
  *
@@ -175,6 +227,28 @@ int main(int argc, char** argv)
     // obtain parameters (don't forget to use a leading '_' when running via command line)
     n.param("topic", SUBSCRIBE_TOPIC_NAME, "/camera/image");
     n.param("display", DISPLAY_RESULT, true);
+    n.param("max_frame_age", MAX_FRAME_AGE, 0.1);
+    n.param("statistics_frames", STATISTICS_FRAMES, 90);
+    int tbbThreads;
+    n.param("tbb_threads", tbbThreads, 0);
+    double deadlineMs;
+    QualityBounds qualityBounds;
+    n.param("deadline_ms", deadlineMs, 1000.0 / 90.0);
+    n.param("min_ransac_iterations", qualityBounds.minRansacIterations, 100);
+    n.param("max_haar_stride", qualityBounds.maxHaarStride, 8);
+    n.param("min_edge_points", qualityBounds.minEdgePoints, 150);
+    n.param("min_inlier_iterations", qualityBounds.minInlierIterations, 1);
+
+    // scale the tracking quality down from the full quality parameters when frames overrun the deadline
+    if(deadlineMs > 0)
+    {
+        PupilTracker::TrackerParams fullQuality;
+        fullQuality.InlierIterations = INLIER_ITERATIONS;
+        qualityScheduler = new QualityScheduler(fullQuality, qualityBounds, deadlineMs);
+    }
+
+    // size the TBB pool used by the tracker, the tracking thread joins it so every core is available to RANSAC
+    tbb::task_scheduler_init tbbInit(tbbThreads > 0 ? tbbThreads : tbb::task_scheduler_init::default_num_threads());
 
     // subscribe to the image stream
     image_transport::ImageTransport imageTransport(nh);
@@ -186,19 +260,55 @@ int main(int argc, char** argv)
         cv::namedWindow(DISPLAY_WINDOW_NAME);
     }
 
-    // set the processing loop rate to 90 Hz
-    ros::Rate loop_rate(90);
+    // handle incoming messages on a background thread, which only posts frames to the mailbox
+    ros::AsyncSpinner spinner(1);
+    spinner.start();
 
-    // process data until program termination
+    // track the newest frame on this thread until program termination
+    QueueStatistics statistics;
     while(ros::ok())
     {
-        // perform one iteration of message handling
-        ros::spinOnce();
+        // wait for the next frame, waking periodically to check for shutdown
+        sensor_msgs::ImageConstPtr msg;
+        ros::Time received;
+        if(!frameMailbox.take(msg, received, ros::WallDuration(0.1)))
+        {
+            continue;
+        }
+
+        // drop frames which are already too old to be worth tracking (cameras without timestamps are never stale)
+        ros::Time start = ros::Time::now();
+        if(MAX_FRAME_AGE > 0 && !msg->header.stamp.isZero() && (start - msg->header.stamp).toSec() > MAX_FRAME_AGE)
+        {
+            statistics.stale++;
+        }
+        else
+        {
+            // record the time the frame spent waiting in the mailbox
+            double latency = (start - received).toSec() * 1000.0;
+            statistics.latencySum += latency;
+            statistics.latencyMax = std::max(statistics.latencyMax, latency);
+            statistics.processed++;
 
-        // pause before sending the next update
-        //loop_rate.sleep();
+            processFrame(msg);
+        }
+
+        // report the queue statistics periodically
+        if(STATISTICS_FRAMES > 0 && statistics.processed + statistics.stale >= (unsigned int)STATISTICS_FRAMES)
+        {
+            unsigned int replaced = frameMailbox.takeReplacedCount();
+            ROS_INFO("Frames processed: %u, replaced: %u, stale: %u, queue latency mean: %.2f ms, max: %.2f ms",
+                statistics.processed, replaced, statistics.stale,
+                statistics.processed > 0 ? statistics.latencySum / statistics.processed : 0.0, statistics.latencyMax);
+            statistics = QueueStatistics();
+        }
     }
 
+    // stop handling messages before releasing resources
+    spinner.stop();
+    delete qualityScheduler;
+    qualityScheduler = NULL;
+
     // release image structures
     if(DISPLAY_RESULT)
     {
@@ -0,0 +1,101 @@
+/*******************************************************************************************************************//**
+ * @FILE pupil_tracking.h
+ * @BRIEF helpers shared by the pupil tracker node and nodelet
+ *
+ * Converts incoming image messages into the grayscale images tracked by the Roboust Pupil Tracker, and summarises
+ * the tracking results.
+ **********************************************************************************************************************/
+
+#ifndef PUPIL_TRACKING_H
+#define PUPIL_TRACKING_H
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include <ros/ros.h>
+#include <cv_bridge/cv_bridge.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/image_encodings.h>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "lib/PupilTracker.h"
+#include "lib/cvx.h"
+
+/*******************************************************************************************************************//**
+ * @BRIEF gets the grayscale image to track from an incoming image message
+ *
+ * The eye cameras deliver mono or YUV frames, whose luma plane is used directly from the message buffer without
+ * copying. Packed YUV and colour frames have their luma gathered into the reusable buffer instead.
+ *
+ * @PARAM[in]  msg input image message
+ * @PARAM[out] buffer storage for the luma plane when it cannot be shared with the message
+ * @PARAM[out] lumaImage the single channel image to track
+ * @RETURNS true if the message encoding could be converted
+ **********************************************************************************************************************/
+inline bool getLumaImage(const sensor_msgs::ImageConstPtr& msg, cv::Mat &buffer, cv::Mat &lumaImage)
+{
+    const std::string& encoding = msg->encoding;
+    const uchar* data = msg->data.empty() ? NULL : &msg->data[0];
+
+    if(encoding == sensor_msgs::image_encodings::MONO8)
+    {
+        lumaImage = cvx::lumaPlane(data, msg->width, msg->height, msg->step, cvx::PIXEL_FORMAT_MONO8, buffer);
+    }
+    else if(encoding == "nv12") // encodings without a sensor_msgs constant are matched by name
+    {
+        lumaImage = cvx::lumaPlane(data, msg->width, msg->height, msg->step, cvx::PIXEL_FORMAT_NV12, buffer);
+    }
+    else if(encoding == "yuyv" || encoding == "yuv422_yuy2")
+    {
+        lumaImage = cvx::lumaPlane(data, msg->width, msg->height, msg->step, cvx::PIXEL_FORMAT_YUYV, buffer);
+    }
+    else if(encoding == sensor_msgs::image_encodings::YUV422)
+    {
+        // the ROS yuv422 encoding is UYVY ordered
+        lumaImage = cvx::lumaPlane(data, msg->width, msg->height, msg->step, cvx::PIXEL_FORMAT_UYVY, buffer);
+    }
+    else
+    {
+        // fall back to converting through cv_bridge, sharing the message buffer when it is already BGR8
+        try
+        {
+            cv_bridge::CvImageConstPtr cvPtr = cv_bridge::toCvShare(msg, sensor_msgs::image_encodings::BGR8);
+            const cv::Mat& image = cvPtr->image;
+            lumaImage = cvx::lumaPlane(image.data, image.cols, image.rows, image.step, cvx::PIXEL_FORMAT_BGR8, buffer);
+        }
+        catch (cv_bridge::Exception &e)
+        {
+            ROS_ERROR("cv_bridge exception: %s", e.what());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*******************************************************************************************************************//**
+ * @BRIEF computes the confidence of a pupil tracking result
+ *
+ * The confidence is the ratio of inlier edge pixels to the circumference of the fitted ellipse, capped at 1, so a
+ * pupil boundary that is fully supported by edges scores 1 and a fit to a few scattered edges scores close to 0.
+ *
+ * @PARAM[in] result the pupil tracking result
+ * @RETURNS confidence in the range [0, 1]
+ **********************************************************************************************************************/
+inline float getPupilConfidence(const PupilTracker::findPupilEllipse_out &result)
+{
+    // Ramanujan's approximation of the ellipse circumference
+    const double a = result.elPupil.size.width / 2.0;
+    const double b = result.elPupil.size.height / 2.0;
+    const double circumference = CV_PI * (3 * (a + b) - std::sqrt((3 * a + b) * (a + 3 * b)));
+
+    if(circumference <= 0)
+    {
+        return 0.0f;
+    }
+
+    return static_cast<float>(std::min(1.0, result.inliers.size() / circumference));
+}
+
+#endif // PUPIL_TRACKING_H
@@ -0,0 +1,198 @@
+/*******************************************************************************************************************//**
+ * @FILE quality_scheduler.h
+ * @BRIEF deadline-aware quality scaling for the Roboust Pupil Tracker
+ *
+ * Measures the per-frame tracking time and steps through a ladder of quality levels so that the 99th percentile
+ * frame time stays under a deadline. Each level lowers one of the expensive tracker knobs (RANSAC iteration cap,
+ * Haar stride, edge point budget and inlier iterations), never past the declared bounds.
+ **********************************************************************************************************************/
+
+#ifndef QUALITY_SCHEDULER_H
+#define QUALITY_SCHEDULER_H
+
+#include <algorithm>
+#include <vector>
+
+#include <ros/ros.h>
+
+#include "lib/PupilTracker.h"
+
+// recover a quality level only once the p99 frame time has this much headroom under the deadline
+#define QUALITY_RECOVERY_FRACTION 0.7
+
+// define a struct to hold the tracker knobs of one quality level
+struct QualityLevel
+{
+    int maxRansacIterations;
+    int haarStride;
+    int maxEdgePoints;
+    int inlierIterations;
+
+    bool operator==(const QualityLevel& other) const
+    {
+        return maxRansacIterations == other.maxRansacIterations && haarStride == other.haarStride &&
+            maxEdgePoints == other.maxEdgePoints && inlierIterations == other.inlierIterations;
+    }
+};
+
+// define a struct to hold the limits which the scheduler may degrade the tracker to
+struct QualityBounds
+{
+    int minRansacIterations;
+    int maxHaarStride;
+    int minEdgePoints;
+    int minInlierIterations;
+};
+
+class QualityScheduler
+{
+public:
+    /***************************************************************************************************************//**
+     * @BRIEF builds the quality ladder, starting from the full quality tracker parameters
+     *
+     * @PARAM[in] params the full quality tracker parameters
+     * @PARAM[in] bounds the lowest quality the tracker may be degraded to
+     * @PARAM[in] deadlineMs the 99th percentile frame time to stay under
+     * @PARAM[in] windowSize the number of frames measured before each decision
+     ******************************************************************************************************************/
+    QualityScheduler(const PupilTracker::TrackerParams& params, const QualityBounds& bounds, double deadlineMs,
+        int windowSize = 200) : m_haarMs(0), m_fittingMs(0),
+        m_deadlineMs(deadlineMs), m_windowSize(std::max(windowSize, 10)), m_level(0)
+    {
+        // full quality
+        QualityLevel level;
+        level.maxRansacIterations = params.MaxRansacIterations;
+        level.haarStride = params.HaarStride;
+        level.maxEdgePoints = params.MaxEdgePoints;
+        level.inlierIterations = params.InlierIterations;
+        addLevel(level, bounds);
+
+        // lower one knob per level, cheapest accuracy loss first
+        level.maxRansacIterations = 500;
+        addLevel(level, bounds);
+        level.maxEdgePoints = 400;
+        addLevel(level, bounds);
+        level.haarStride += 2;
+        addLevel(level, bounds);
+        level.inlierIterations -= 1;
+        addLevel(level, bounds);
+        level.maxRansacIterations = 250;
+        level.maxEdgePoints = 250;
+        addLevel(level, bounds);
+        level.maxRansacIterations = bounds.minRansacIterations;
+        level.haarStride = bounds.maxHaarStride;
+        level.maxEdgePoints = bounds.minEdgePoints;
+        level.inlierIterations = bounds.minInlierIterations;
+        addLevel(level, bounds);
+
+        m_frameTimes.reserve(m_windowSize);
+    }
+
+    /***************************************************************************************************************//**
+     * @BRIEF sets the knobs of the current quality level in the tracker parameters
+     *
+     * @PARAM[in,out] params the tracker parameters for the next frame
+     ******************************************************************************************************************/
+    void apply(PupilTracker::TrackerParams& params) const
+    {
+        const QualityLevel& level = m_levels[m_level];
+        params.MaxRansacIterations = level.maxRansacIterations;
+        params.HaarStride = level.haarStride;
+        params.MaxEdgePoints = level.maxEdgePoints;
+        params.InlierIterations = level.inlierIterations;
+    }
+
+    /***************************************************************************************************************//**
+     * @BRIEF records the timing of a tracked frame, and changes the quality level once a full window is measured
+     *
+     * Degrades one level when the 99th percentile frame time exceeds the deadline, and recovers one level only when it
+     * falls well below the deadline, so the level does not oscillate.
+     *
+     * @PARAM[in] frameMs the time taken to track the frame in milliseconds
+     * @PARAM[in] log the tracker log of the frame, holding the stage times
+     ******************************************************************************************************************/
+    void addFrame(double frameMs, const tracker_log& log)
+    {
+        m_frameTimes.push_back(frameMs);
+        m_haarMs += std::max(0.0, log.time("Haar responses"));
+        m_fittingMs += std::max(0.0, log.time("Ellipse fitting"));
+        if((int)m_frameTimes.size() < m_windowSize)
+        {
+            return;
+        }
+
+        // find the 99th percentile frame time of the window
+        size_t index = (m_frameTimes.size() * 99) / 100;
+        std::nth_element(m_frameTimes.begin(), m_frameTimes.begin() + index, m_frameTimes.end());
+        double p99 = m_frameTimes[index];
+
+        if(p99 > m_deadlineMs && m_level + 1 < (int)m_levels.size())
+        {
+            m_level++;
+            const QualityLevel& level = m_levels[m_level];
+            ROS_WARN("Tracking p99 %.2f ms over the %.2f ms deadline (haar %.2f ms, fitting %.2f ms), degrading to "
+                "quality level %d: ransac iterations %d, haar stride %d, edge points %d, inlier iterations %d",
+                p99, m_deadlineMs, m_haarMs / m_frameTimes.size(), m_fittingMs / m_frameTimes.size(), m_level,
+                level.maxRansacIterations, level.haarStride, level.maxEdgePoints, level.inlierIterations);
+        }
+        else if(p99 < QUALITY_RECOVERY_FRACTION * m_deadlineMs && m_level > 0)
+        {
+            m_level--;
+            ROS_INFO("Tracking p99 %.2f ms under the %.2f ms deadline, recovering to quality level %d", p99,
+                m_deadlineMs, m_level);
+        }
+
+        // start a new window
+        m_frameTimes.clear();
+        m_haarMs = 0;
+        m_fittingMs = 0;
+    }
+
+    int level() const
+    {
+        return m_level;
+    }
+
+private:
+    /***************************************************************************************************************//**
+     * @BRIEF clamps a quality level to the bounds and appends it to the ladder, unless it matches the previous level
+     *
+     * @PARAM[in] level the knobs of the new level
+     * @PARAM[in] bounds the lowest quality the tracker may be degraded to
+     ******************************************************************************************************************/
+    void addLevel(QualityLevel level, const QualityBounds& bounds)
+    {
+        if(!m_levels.empty())
+        {
+            // a bounded knob may only get cheaper, and no further than its bound (0 means unlimited)
+            const QualityLevel& previous = m_levels.back();
+            level.maxRansacIterations = clampLimit(level.maxRansacIterations, previous.maxRansacIterations,
+                bounds.minRansacIterations);
+            level.maxEdgePoints = clampLimit(level.maxEdgePoints, previous.maxEdgePoints, bounds.minEdgePoints);
+            level.haarStride = std::max(previous.haarStride, std::min(level.haarStride, bounds.maxHaarStride));
+            level.inlierIterations = std::min(previous.inlierIterations,
+                std::max(level.inlierIterations, bounds.minInlierIterations));
+            if(level == previous)
+            {
+                return;
+            }
+        }
+        m_levels.push_back(level);
+    }
+
+    static int clampLimit(int value, int previous, int bound)
+    {
+        value = std::max(value, bound);
+        return previous > 0 ? std::min(value, previous) : value;
+    }
+
+    std::vector<QualityLevel> m_levels;
+    std::vector<double> m_frameTimes;
+    double m_haarMs;
+    double m_fittingMs;
+    double m_deadlineMs;
+    int m_windowSize;
+    int m_level;
+};
+
+#endif // QUALITY_SCHEDULER_H
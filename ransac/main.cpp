@@ -1,16 +1,16 @@
-#include <eigen3/Eigen/Dense>
-#include <opencv2/core/eigen.hpp>
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <algorithm>
+#include <tbb/tbb.h>
 #include <math.h>
+#include <ctype.h>
+#include "EllipseFitCv.h"
 
 #define PI 3.14159265
 
 using namespace std;
 using namespace cv;
-using namespace Eigen;
 
 // Class to hold RANSAC parameters
 class RANSACparams {
@@ -26,18 +26,106 @@ private:
 
     //number of points to select randomly at each iteration
     int N;
+
+    //seed of the random samples, the same seed gives the same result on any number of threads
+    int seed;
 public:
-    RANSACparams(int _iter, int _min_inliers, float _dist_thresh, int _N) { //constructor
+    RANSACparams(int _iter, int _min_inliers, float _dist_thresh, int _N, int _seed = 0) { //constructor
         iter = _iter;
         min_inliers = _min_inliers;
         dist_thresh = _dist_thresh;
         N = _N;
+        seed = _seed;
     }
 
     int get_iter() {return iter;}
     int get_min_inliers() {return min_inliers;}
     float get_dist_thresh() {return dist_thresh;}
     int get_N() {return N;}
+    int get_seed() {return seed;}
+};
+
+
+
+// Centre, semi axis lengths and angle of rotation of an ellipse
+struct ellipseGeometry {
+    Point2f center;
+    float major_axis, minor_axis, alpha;
+    bool valid; 											// false if the conic is not a real ellipse
+};
+
+
+
+// Conic section q[0] x^2 + q[1] xy + q[2] y^2 + q[3] x + q[4] y + q[5] = 0, held by value
+struct Conic6f {
+    float q[6];
+
+    // the conic 1 = 0, which has no points
+    static constexpr Conic6f none() {return Conic6f{{0.f, 0.f, 0.f, 0.f, 0.f, 1.f}};}
+
+    constexpr Conic6f operator-() const {return Conic6f{{-q[0], -q[1], -q[2], -q[3], -q[4], -q[5]}};}
+
+    // derives the ellipse geometry from the coefficients, written as a, 2b, c, 2d, 2f, g
+    ellipseGeometry geometry() const {
+        float a = q[0], b = q[1]/2, c = q[2], d = q[3]/2, f = q[4]/2, g = q[5];
+
+        ellipseGeometry e;
+        e.center = Point2f(0.f, 0.f);
+        e.major_axis = e.minor_axis = e.alpha = 0.f;
+        e.valid = false;
+        if(b*b - a*c == 0)
+            return e;
+
+        e.center = Point2f((c*d - b*f)/(b*b - a*c), (a*f - b*d)/(b*b - a*c));
+
+        float num = 2 * (a*f*f + c*d*d + g*b*b - 2*b*d*f - a*c*g),
+                root = sqrt((a-c)*(a-c) + 4*b*b),
+                a_sq = num / ((b*b - a*c) * (root - (a + c))),
+                b_sq = num / ((b*b - a*c) * (-root - (a + c)));
+        if(!(a_sq >= 0.f && b_sq >= 0.f))
+            return e;
+        e.major_axis = sqrt(max(a_sq, b_sq));
+        e.minor_axis = sqrt(min(a_sq, b_sq));
+        e.valid = true;
+
+        //angle of rotation of ellipse
+        if(b == 0.f && a == c)
+            e.alpha = PI/2;
+        else if(b != 0.f && a > c)
+            e.alpha = 0.5 * atan2(2*b, a-c);
+        else if(b != 0.f && a < c)
+            e.alpha = PI/2 - 0.5 * atan2(2*b, a-c);
+
+        return e;
+    }
+};
+
+ostream& operator<<(ostream& os, const Conic6f& Q) {
+    return os << "[" << Q.q[0] << ", " << Q.q[1] << ", " << Q.q[2] << ", " << Q.q[3] << ", " << Q.q[4] << ", " << Q.q[5] << "]";
+}
+
+
+
+// Non-owning view of the points of one contour
+struct contourView {
+    const Point* pts;
+    int n;
+
+    contourView(const Point* _pts, int _n) : pts(_pts), n(_n) {}
+    contourView(const vector<Point>& c) : pts(c.data()), n(c.size()) {}
+
+    int size() const {return n;}
+    const Point& operator[](int i) const {return pts[i];}
+};
+
+
+
+// Buffers of one worker thread running RANSAC iterations
+struct RANSACworkspace {
+    vector<int> idx; 										// identity permutation of contour indices, restored after each sample
+    vector<int> swaps; 										// swaps of the last sample, to restore idx
+    vector<Point> consensus_set; 							// consensus set of the last iteration
+    vector<float> d; 										// distances of the contour points from the last model
 };
 
 
@@ -46,280 +134,363 @@ public:
 class ellipseFinder {
 private:
     Mat img; 												// input image
-    vector<vector<Point> > contours; 						// contours in image
-    Mat Q; 													// Matrix representing conic section of detected ellipse
-    Mat fit_ellipse(vector<Point>); 						// function to fit ellipse to a contour
-    Mat RANSACellipse(vector<vector<Point> >); 				// function to find ellipse in contours using RANSAC
-    bool is_good_ellipse(Mat); 								// function that determines whether given conic section represents a valid ellipse
-    vector<vector<Point> > choose_random(vector<Point>); 	// function to choose points at random from contour
-    vector<float> distance(Mat, vector<Point>); 			// function to return distance of points from the ellipse
-    float distance(Mat, Point); 							// overloaded function to return signed distance of point from ellipse
-    void draw_ellipse(Mat); 								// function to draw ellipse in an image
-    vector<Point> ellipse_contour(Mat); 					// function to convert equation of ellipse to a contour of points
-    void draw_inliers(Mat, vector<Point>); 					// function to debug inliers
+    vector<Point> points; 									// points of the long contours in image, one contour after another
+    vector<int> offsets; 									// contour i is points[offsets[i]] up to points[offsets[i + 1]]
+    Conic6f Q; 												// conic section of detected ellipse
+    Conic6f fit_ellipse(contourView); 						// function to fit ellipse to a contour
+    Conic6f RANSACellipse(); 								// function to find ellipse in contours using RANSAC
+    bool is_good_ellipse(const Conic6f&); 					// function that determines whether given conic section represents a valid ellipse
+    void choose_random(vector<int>&, int, RNG&, vector<int>&); // function to choose points at random from contour
+    int consensus(contourView, int, int, RANSACworkspace&); // function to run one RANSAC iteration on a contour
+    void distance(const Conic6f&, contourView, vector<float>&); // function to return distance of points from the ellipse
+    float distance(const Conic6f&, Point); 					// overloaded function to return signed distance of point from ellipse
+    void draw_ellipse(const Conic6f&); 						// function to draw ellipse in an image
+    vector<Point> ellipse_contour(const Conic6f&); 			// function to convert equation of ellipse to a contour of points
+    void draw_inliers(const Conic6f&, contourView); 		// function to debug inliers
+    void draw_contours(Mat&, Scalar, int); 					// function to draw the long contours
+
+    void find_contours(); 									// function to extract the long contours of img
+    int num_contours() {return offsets.size() - 1;}
+    contourView contour(int i) {return contourView(points.data() + offsets[i], offsets[i + 1] - offsets[i]);}
 
     // RANSAC parameters
-    int iter, min_inliers, N;
+    int iter, min_inliers, N, seed;
     float dist_thresh;
 
-public:
-    ellipseFinder(Mat _img, int l_canny, int h_canny, RANSACparams rp) { // constructor
-        img = _img.clone();
-
-        // Edge detection and contour extraction
-        Mat edges; Canny(img, edges, l_canny, h_canny);
-        vector<vector<Point> > c;
-        findContours(edges, c, CV_RETR_LIST, CV_CHAIN_APPROX_NONE);
-
-        // Remove small spurious short contours
-        for(int i = 0; i < c.size(); i++) {
-            bool is_closed = false;
-
-            vector<Point> _c = c[i];
+    // Canny thresholds
+    int l_canny, h_canny;
 
-            Point p1 = _c.front(), p2 = _c.back();
-            float d = sqrt(pow(p1.x - p2.x,2) + pow(p1.y - p2.y,2));
-            if(d <= 0.5) is_closed = true;
+    // buffers reused between the frames of a stream
+    Mat edges; 												// edge image
+    vector<vector<Point> > frame_contours; 					// all contours of the edge image
+    vector<char> keep_contour; 								// whether each contour passed the length filter
 
-            d = arcLength(_c, is_closed);
+    // warm start from the previous frame
+    bool has_Q; 											// whether Q is the ellipse found in the previous frame
+    int contour_best; 										// index of the contour that supports Q, or -1
+    float warm_accept; 										// inlier fraction of the previous ellipse that shortens the search
 
-            if(d > 50) contours.push_back(_c);
-        }
+public:
+    ellipseFinder(int _l_canny, int _h_canny, RANSACparams rp) { // constructor for a stream of frames
+        l_canny = _l_canny;
+        h_canny = _h_canny;
 
         iter = rp.get_iter();
         min_inliers = rp.get_min_inliers();
         N = rp.get_N();
         dist_thresh = rp.get_dist_thresh();
+        seed = rp.get_seed();
+
+        offsets.assign(1, 0);
 
-        Q = Mat::eye(6, 1, CV_32F);
+        Q = Conic6f::none();
+        has_Q = false;
+        contour_best = -1;
+        warm_accept = 0.9f;
+    }
+
+    ellipseFinder(Mat _img, int l_canny, int h_canny, RANSACparams rp) : ellipseFinder(l_canny, h_canny, rp) { // constructor for a single image
+        img = _img.clone();
+        find_contours();
 
         /*
         //for debug
         Mat img_show = img.clone();
-        drawContours(img_show, contours, -1, Scalar(0, 0, 255));
+        draw_contours(img_show, Scalar(0, 0, 255), 1);
         imshow("Contours", img_show);
         //imshow("Edges", edges);
         */
-        cout << "No. of Contours = " << contours.size() << endl;
+        cout << "No. of Contours = " << num_contours() << endl;
     }
     void detect_ellipse(); 	//final wrapper function
     void debug(); 			//debug function
+    bool process(const Mat&); //function to find the ellipse in the next frame of a stream
+    void show(); 			//function to display the ellipse of the last frame
+    Conic6f get_ellipse() {return Q;}
 };
 
 
 
-vector<float> ellipseFinder::distance(Mat Q, vector<Point> c) {
-    vector<Point> ellipse = ellipse_contour(Q);
-    vector<float> distances;
-    for(int i = 0; i < c.size(); i++) {
-        distances.push_back(float(pointPolygonTest(ellipse, c[i], true)));
+void ellipseFinder::find_contours() {
+    // Edge detection and contour extraction
+    Canny(img, edges, l_canny, h_canny);
+    findContours(edges, frame_contours, CV_RETR_LIST, CV_CHAIN_APPROX_NONE);
+
+    // Remove small spurious short contours. Neighbouring chain points are at most sqrt(2) apart, so a contour of
+    // fewer than 36 points cannot be longer than 50 px, and one of more than 51 points is always longer, which
+    // leaves arcLength to measure only the contours in between
+    const int n_contours = frame_contours.size();
+    keep_contour.assign(n_contours, 0);
+    tbb::parallel_for(tbb::blocked_range<int>(0, n_contours, 64), [&](const tbb::blocked_range<int>& range) {
+        for(int i = range.begin(); i < range.end(); i++) {
+            const vector<Point>& _c = frame_contours[i];
+            const int n = _c.size();
+
+            if(n < 36) continue;
+            if(n > 51) {
+                keep_contour[i] = 1;
+                continue;
+            }
+
+            // the chain is closed when its ends meet, the points are integer so no sqrt is needed
+            Point p1 = _c.front(), p2 = _c.back();
+            int dx = p1.x - p2.x, dy = p1.y - p2.y;
+            bool is_closed = dx * dx + dy * dy == 0;
+
+            keep_contour[i] = arcLength(_c, is_closed) > 50;
+        }
+    });
+
+    // copy the kept contours into the point arena in order, so the result does not depend on the scheduling
+    points.clear();
+    offsets.assign(1, 0);
+    for(int i = 0; i < n_contours; i++) {
+        if(!keep_contour[i]) continue;
+
+        const vector<Point>& _c = frame_contours[i];
+        points.insert(points.end(), _c.begin(), _c.end());
+        offsets.push_back(points.size());
     }
+}
+
 
-    return distances;
+
+bool ellipseFinder::process(const Mat& frame) {
+    // the frame is only read while it is processed, so it is not copied
+    img = frame;
+    find_contours();
+    Q = RANSACellipse();
+    has_Q = contour_best >= 0;
+    return has_Q;
 }
 
 
 
-float ellipseFinder::distance(Mat Q, Point p) {
-    vector<Point> ellipse = ellipse_contour(Q);
-    return float(pointPolygonTest(ellipse, p, true));
+void ellipseFinder::show() {
+    if(contour_best >= 0) draw_ellipse(Q);
+    else imshow("Ellipse", img);
 }
 
 
 
-vector<vector<Point> > ellipseFinder::choose_random(vector<Point> c) {
+// the coefficients of Conic6f are in the order of the library conic
+static inline ellipse_fit::Conic as_conic(const Conic6f& Q) {
+    ellipse_fit::Conic q = {Q.q[0], Q.q[1], Q.q[2], Q.q[3], Q.q[4], Q.q[5]};
+    return q;
+}
 
-    vector<vector<Point> > cr;
-    vector<Point> cr0, cr1;
 
-    // Randomly shuffle all elements of contour
-    std::random_shuffle(c.begin(), c.end());
 
-    // Put the first N elements into cr[0] as consensus set (see Wikipedia RANSAC algorithm) and the rest in cr[1] to check for inliers
-    for(int i = 0; i < c.size(); i++) {
-        if(i < N) cr0.push_back(c[i]);
-        else cr1.push_back(c[i]);
-    }
-    cr.push_back(cr0);
-    cr.push_back(cr1);
+void ellipseFinder::distance(const Conic6f& Q, contourView c, vector<float>& distances) {
+    // Sampson distances, with the SIMD kernel of the library
+    distances.resize(c.size());
+    ellipse_fit::sampsonDistances(as_conic(Q), c.pts, c.n, distances.data());
+}
+
 
-    return cr;
+
+float ellipseFinder::distance(const Conic6f& Q, Point p) {
+    return ellipse_fit::sampsonDistance(as_conic(Q), float(p.x), float(p.y));
 }
 
 
 
-Mat ellipseFinder::fit_ellipse(vector<Point> c) {
-    /*
-    // for debug
-    Mat img_show = img.clone();
-    vector<vector<Point> > cr;
-    cr.push_back(c);
-    drawContours(img_show, cr, -1, Scalar(0, 0, 255), 2);
-    imshow("Debug fitEllipse", img_show);
-    */
-    int N = c.size();
-    Mat D;
-    for(int i = 0; i < N; i++) {
-        Point p = c[i];
-        Mat r(1, 6, CV_32FC1);
-        r = (Mat_<float>(1, 6) << (p.x)*(p.x), (p.x)*(p.y), (p.y)*(p.y), p.x, p.y, 1.f);
-        D.push_back(r);
+void ellipseFinder::choose_random(vector<int>& idx, int n, RNG& rng, vector<int>& swaps) {
+    // Partial Fisher-Yates shuffle: only the first N entries of the permutation of 0..n-1 are drawn. They are the
+    // consensus set (see Wikipedia RANSAC algorithm) and the rest are checked for inliers. The swaps are recorded, so
+    // that the caller can restore idx to the identity and the next sample only depends on its random stream
+    swaps.clear();
+    for(int i = 0; i < N && i < n - 1; i++) {
+        int j = i + rng.uniform(0, n - i);
+        swap(idx[i], idx[j]);
+        swaps.push_back(j);
     }
-    Mat S = D.t() * D, _S;
+}
 
-    double d = invert(S, _S);
-    //if(d < 0.001) cout << "S matrix is singular" << endl;
 
-    Mat C = Mat::zeros(6, 6, CV_32F);
-    C.at<float>(2, 0) = 2;
-    C.at<float>(1, 1) = -1;
-    C.at<float>(0, 2) = 2;
 
-    // Using EIGEN to calculate eigenvalues and eigenvectors
-    Mat prod = _S * C;
-    Eigen::MatrixXd prod_e;
-    cv2eigen(prod, prod_e);
-    EigenSolver<Eigen::MatrixXd> es(prod_e);
+// Random stream of one RANSAC iteration, mixed from the seed, contour and iteration (splitmix64)
+static inline uint64 iteration_seed(int seed, int contour, int iteration) {
+    uint64 z = ((uint64)(unsigned)seed << 40) ^ ((uint64)contour << 20) ^ (uint64)iteration;
+    z += 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
 
-    Mat evec, eval, vec(6, 6, CV_32FC1), val(6, 1, CV_32FC1);
 
-    eigen2cv(es.eigenvectors(), evec);
-    eigen2cv(es.eigenvalues(), eval);
+int ellipseFinder::consensus(contourView c, int contour, int iteration, RANSACworkspace& ws) {
+    int n = c.size();
+    ws.consensus_set.clear();
+
+    // iteration -1 is the warm start, which checks the ellipse of the previous frame for inliers
+    if(iteration < 0) {
+        distance(Q, c, ws.d);
+        for(int k = 0; k < n; k++)
+            if(abs(ws.d[k]) < dist_thresh)
+                ws.consensus_set.push_back(c[k]);
+        return ws.consensus_set.size();
+    }
+
+    for(int k = ws.idx.size(); k < n; k++) ws.idx.push_back(k);
+    RNG rng(iteration_seed(seed, contour, iteration));
 
-    evec.convertTo(evec, CV_32F);
-    eval.convertTo(eval, CV_32F);
+    // ...choose points at random...
+    choose_random(ws.idx, n, rng, ws.swaps);
+    for(int k = 0; k < N; k++) ws.consensus_set.push_back(c[ws.idx[k]]);
 
-    // Eigen returns complex parts in the second channel (which are all 0 here) so select just the first channel
-    int from_to[] = {0, 0};
-    mixChannels(&evec, 1, &vec, 1, from_to, 1);
-    mixChannels(&eval, 1, &val, 1, from_to, 1);
+    // ...fit ellipse to those points...
+    Conic6f Q_maybe = fit_ellipse(ws.consensus_set);
 
-    Point maxLoc;
-    minMaxLoc(val, NULL, NULL, NULL, &maxLoc);
+    // ...check the rest of the contour for inliers...
+    distance(Q_maybe, c, ws.d);
+    for(int k = N; k < n; k++)
+        if(abs(ws.d[ws.idx[k]]) < dist_thresh)
+            ws.consensus_set.push_back(c[ws.idx[k]]);
 
-    return vec.col(maxLoc.y);
+    // restore the identity permutation
+    for(int k = ws.swaps.size() - 1; k >= 0; k--)
+        swap(ws.idx[k], ws.idx[ws.swaps[k]]);
+
+    return ws.consensus_set.size();
 }
 
 
 
-bool ellipseFinder::is_good_ellipse(Mat Q) {
-    float a = Q.at<float>(0, 0),
-            b = (Q.at<float>(1, 0))/2,
-            c = Q.at<float>(2, 0),
-            d = (Q.at<float>(3, 0))/2,
-            f = (Q.at<float>(4, 0))/2,
-            g = Q.at<float>(5, 0);
+Conic6f ellipseFinder::fit_ellipse(contourView c) {
+    /*
+    // for debug
+    Mat img_show = img.clone();
+    polylines(img_show, &c.pts, &c.n, 1, true, Scalar(0, 0, 255), 2);
+    imshow("Debug fitEllipse", img_show);
+    */
+
+    // Direct least squares ellipse fit by Halir and Flusser (see EllipseFit.h). If no ellipse fits, the conic 1 = 0
+    // is returned, which is not a good ellipse and is far from every point
+    ellipse_fit::Conic conic;
+    ellipse_fit::fitAlgebraic(c.pts, c.n, conic);
+
+    Conic6f Q = {{conic.A, conic.B, conic.C, conic.D, conic.E, conic.F}};
+    return Q;
+}
 
-    if(b*b - a*c == 0)
-        return false;
 
-    float thresh = 0.09,
-            num = 2 * (a*f*f + c*d*d + g*b*b - 2*b*d*f - a*c*g),
-            den1 = (b*b - a*c) * (sqrt((a-c)*(a-c) + 4*b*b) - (a + c)),
-            den2 = (b*b - a*c) * (-sqrt((a-c)*(a-c) + 4*b*b) - (a + c)),
-            a_len = sqrt(num / den1),
-            b_len = sqrt(num / den2),
-            major_axis = max(a_len, b_len),
-            minor_axis = min(a_len, b_len);
 
-    if(minor_axis < thresh*major_axis || num/den1 < 0.f || num/den2 < 0.f || major_axis > max(img.rows, img.cols))
+bool ellipseFinder::is_good_ellipse(const Conic6f& Q) {
+    ellipseGeometry e = Q.geometry();
+
+    float thresh = 0.09;
+    if(!e.valid || e.minor_axis < thresh*e.major_axis || e.major_axis > max(img.rows, img.cols))
         return false;
     else return true;
 }
 
 
 
-Mat ellipseFinder::RANSACellipse(vector<vector<Point> > contours) {
+Conic6f ellipseFinder::RANSACellipse() {
     int best_overall_inlier_score = 0;
-    Mat Q_best = 777 * Mat::ones(6, 1, CV_32FC1);
+    Conic6f Q_best = Conic6f::none();
     int idx_best = -1;
 
-    //for each contour...
-    for(int i = 0; i < contours.size(); i++) {
-        vector<Point> c = contours[i];
-        if(c.size() < min_inliers) continue;
-
-        Mat Q;
-        int best_inlier_score = 0;
-        for(int j = 0; j < iter; j++) {
-
-            // ...choose points at random...
-            vector<vector<Point> > cr = choose_random(c);
-            vector<Point> consensus_set = cr[0], rest = cr[1];
-
-            // ...fit ellipse to those points...
-            Mat Q_maybe = fit_ellipse(consensus_set);
-
-            // ...check for inliers...
-            vector<float> d = distance(Q_maybe, rest);
-            for(int k = 0; k < d.size(); k++)
-                if(abs(d[k]) < dist_thresh)
-                    consensus_set.push_back(rest[k]);
-
-            // ...and find the random set with the most number of inliers
-            if(consensus_set.size() > min_inliers && consensus_set.size() > best_inlier_score) {
-                Q = fit_ellipse(consensus_set);
-                best_inlier_score = consensus_set.size();
+    // contours with enough points for a model
+    vector<int> candidates;
+    for(int i = 0; i < num_contours(); i++)
+        if(contour(i).size() >= min_inliers) candidates.push_back(i);
+    int m = candidates.size();
+
+    // run all (contour, iteration) pairs in parallel, reducing to the best (inlier score, iteration) of each contour.
+    // Ties go to the earlier iteration, so the result does not depend on the scheduling
+    typedef vector<pair<int, int> > Scores;
+    auto better = [](const pair<int, int>& a, const pair<int, int>& b) {
+        return a.first > b.first || (a.first == b.first && a.first > 0 && a.second < b.second);
+    };
+
+    // score the ellipse of the previous frame on every contour, as iteration -1. If it is still well supported, only a
+    // short search for a better one is needed
+    Scores warm(m, make_pair(0, -1));
+    int search_iter = iter;
+    if(has_Q) {
+        RANSACworkspace ws;
+        for(int k = 0; k < m; k++) {
+            int score = consensus(contour(candidates[k]), candidates[k], -1, ws);
+            if(score > min_inliers) {
+                warm[k] = make_pair(score, -1);
+                if(score >= warm_accept * contour(candidates[k]).size())
+                    search_iter = max(1, iter / 4);
             }
         }
+    }
+
+    tbb::enumerable_thread_specific<RANSACworkspace> workspaces;
+    Scores best = tbb::parallel_reduce(
+        tbb::blocked_range<int>(0, m * search_iter, 16),
+        Scores(m, make_pair(0, -1)),
+        [&](const tbb::blocked_range<int>& range, Scores scores) -> Scores {
+            RANSACworkspace& ws = workspaces.local();
+            for(int p = range.begin(); p < range.end(); p++) {
+                int k = p / search_iter, j = p % search_iter;
+                pair<int, int> score(consensus(contour(candidates[k]), candidates[k], j, ws), j);
+
+                // ...and find the random set with the most number of inliers
+                if(score.first > min_inliers && better(score, scores[k]))
+                    scores[k] = score;
+            }
+            return scores;
+        },
+        [&](Scores a, const Scores& b) -> Scores {
+            for(int k = 0; k < m; k++)
+                if(better(b[k], a[k])) a[k] = b[k];
+            return a;
+        });
+
+    for(int k = 0; k < m; k++)
+        if(better(warm[k], best[k])) best[k] = warm[k];
+
+    RANSACworkspace ws;
+    for(int k = 0; k < m; k++) {
+        int best_inlier_score = best[k].first;
+        if(best_inlier_score <= best_overall_inlier_score) continue;
+
+        // replay the best iteration of the contour to refit its consensus set
+        consensus(contour(candidates[k]), candidates[k], best[k].second, ws);
+        Conic6f Q = fit_ellipse(ws.consensus_set);
 
         // find cotour with ellipse that has the most number of inliers
-        if(best_inlier_score > best_overall_inlier_score && is_good_ellipse(Q)) {
+        if(is_good_ellipse(Q)) {
             best_overall_inlier_score = best_inlier_score;
-            Q_best = Q.clone();
-            if(Q_best.at<float>(5, 0) < 0)
-                Q_best *= -1.f;
-            idx_best = i;
+            Q_best = Q.q[5] < 0 ? -Q : Q;
+            idx_best = candidates[k];
         }
     }
 
     /*
     //for debug
     Mat img_show = img.clone();
-    drawContours(img_show, contours, idx_best, Scalar(0, 0, 255), 2);
+    contourView c = contour(idx_best);
+    polylines(img_show, &c.pts, &c.n, 1, true, Scalar(0, 0, 255), 2);
     imshow("Best Contour", img_show);
 
     cout << "inliers " << best_overall_inlier_score << endl;
     */
 
-    if(idx_best >= 0) draw_inliers(Q_best, contours[idx_best]);
+    contour_best = idx_best;
     return Q_best;
 }
 
 
 
-vector<Point> ellipseFinder::ellipse_contour(Mat Q) {
-    float a = Q.at<float>(0, 0),
-            b = (Q.at<float>(1, 0))/2,
-            c = Q.at<float>(2, 0),
-            d = (Q.at<float>(3, 0))/2,
-            f = (Q.at<float>(4, 0))/2,
-            g = Q.at<float>(5, 0);
+vector<Point> ellipseFinder::ellipse_contour(const Conic6f& Q) {
+    ellipseGeometry e = Q.geometry();
 
     vector<Point> ellipse;
-    if(b*b - a*c == 0) {
+    if(!e.valid) {
         ellipse.push_back(Point(0, 0));
         return ellipse;
     }
 
-    Point2f center((c*d - b*f)/(b*b - a*c), (a*f - b*d)/(b*b - a*c));
-
-    float num = 2 * (a*f*f + c*d*d + g*b*b - 2*b*d*f - a*c*g),
-            den1 = (b*b - a*c) * (sqrt((a-c)*(a-c) + 4*b*b) - (a + c)),
-            den2 = (b*b - a*c) * (-sqrt((a-c)*(a-c) + 4*b*b) - (a + c)),
-            a_len = sqrt(num / den1),
-            b_len = sqrt(num / den2),
-            major_axis = max(a_len, b_len),
-            minor_axis = min(a_len, b_len);
-
-    //angle of rotation of ellipse
-    float alpha = 0.f;
-    if(b == 0.f && a == c)
-        alpha = PI/2;
-    else if(b != 0.f && a > c)
-        alpha = 0.5 * atan2(2*b, a-c);
-    else if(b != 0.f && a < c)
-        alpha = PI/2 - 0.5 * atan2(2*b, a-c);
+    Point2f center = e.center;
+    float major_axis = e.major_axis, minor_axis = e.minor_axis, alpha = e.alpha;
 
     // 'draw' the ellipse and put it into a STL Point vector so you can use drawContours()
     int N = 200;
@@ -340,7 +511,8 @@ vector<Point> ellipseFinder::ellipse_contour(Mat Q) {
 
 
 void ellipseFinder::detect_ellipse() {
-    Q = RANSACellipse(contours);
+    Q = RANSACellipse();
+    if(contour_best >= 0) draw_inliers(Q, contour(contour_best));
     cout << "Q" << Q << endl;
     draw_ellipse(Q);
 }
@@ -349,18 +521,19 @@ void ellipseFinder::detect_ellipse() {
 
 void ellipseFinder::debug() {
     int i = 1; 		//index of contour you want to debug
-    cout << "No. of points in contour " << contours[i].size() << endl;
-    Mat a = fit_ellipse(contours[i]);
+    contourView c = contour(i);
+    cout << "No. of points in contour " << c.size() << endl;
+    Conic6f a = fit_ellipse(c);
     Mat img_show = img.clone();
-    drawContours(img_show, contours, i, Scalar(0, 0, 255), 3);
+    polylines(img_show, &c.pts, &c.n, 1, true, Scalar(0, 0, 255), 3);
     imshow("Debug contour", img_show);
-    draw_inliers(a, contours[i]);
+    draw_inliers(a, c);
     draw_ellipse(a);
 }
 
 
 
-void ellipseFinder::draw_ellipse(Mat Q) {
+void ellipseFinder::draw_ellipse(const Conic6f& Q) {
     vector<Point> ellipse = ellipse_contour(Q);
     vector<vector<Point> > c;
     c.push_back(ellipse);
@@ -371,14 +544,13 @@ void ellipseFinder::draw_ellipse(Mat Q) {
 
 
 
-void ellipseFinder::draw_inliers(Mat Q, vector<Point> c) {
-    vector<Point> ellipse = ellipse_contour(Q);
+void ellipseFinder::draw_inliers(const Conic6f& Q, contourView c) {
     vector<vector<Point> > cs;
-    cs.push_back(ellipse);
+    cs.push_back(ellipse_contour(Q));
     Mat img_show = img.clone();
 
     // draw all contours in thin red
-    drawContours(img_show, contours, -1, Scalar(0, 0, 255));
+    draw_contours(img_show, Scalar(0, 0, 255), 1);
 
     // draw ellipse in thin blue
     drawContours(img_show, cs, 0, Scalar(255, 0, 0));
@@ -386,10 +558,10 @@ void ellipseFinder::draw_inliers(Mat Q, vector<Point> c) {
     int count = 0;
 
     // draw inliers as green points
+    vector<float> d;
+    distance(Q, c, d);
     for(int i = 0; i < c.size(); i++) {
-        double d = pointPolygonTest(ellipse, c[i], true);
-        float d1 = float(d);
-        if(abs(d1) < dist_thresh) {
+        if(abs(d[i]) < dist_thresh) {
             circle(img_show, c[i], 1, Scalar(0, 255, 0), -1);
             count ++;
         }
@@ -400,22 +572,71 @@ void ellipseFinder::draw_inliers(Mat Q, vector<Point> c) {
 
 
 
-int main() {
-    Mat img = imread("ipupil2.jpeg");
-    namedWindow("Ellipse");
+void ellipseFinder::draw_contours(Mat& img_show, Scalar color, int thickness) {
+    for(int i = 0; i < num_contours(); i++) {
+        contourView c = contour(i);
+        polylines(img_show, &c.pts, &c.n, 1, true, color, thickness);
+    }
+}
+
 
+
+int main(int argc, char** argv) {
     // object holding RANSAC parameters, initialized using the constructor
     RANSACparams rp(400, 100, 1, 5);
 
     // Canny thresholds
     int canny_l = 250, canny_h = 300;
 
-    // Ellipse finder object, initialized using the constructor
-    ellipseFinder ef(img, canny_l, canny_h, rp);
-    ef.detect_ellipse();
-    //ef.debug();
+    // a still image is processed once, anything else is streamed from a video file or camera index
+    string source = argc > 1 ? argv[1] : "ipupil2.jpeg";
+    bool display = argc < 3 || atoi(argv[2]) > 0;
+    Mat img = imread(source);
+    if(!img.empty()) {
+        namedWindow("Ellipse");
+
+        // Ellipse finder object, initialized using the constructor
+        ellipseFinder ef(img, canny_l, canny_h, rp);
+        ef.detect_ellipse();
+        //ef.debug();
+
+        while(char(waitKey(1)) != 'q') {}
+
+        return 0;
+    }
+
+    VideoCapture cap;
+    if(source.size() == 1 && isdigit(source[0])) cap.open(source[0] - '0');
+    else cap.open(source);
+    if(!cap.isOpened()) {
+        cout << "Unable to open " << source << endl;
+        return 1;
+    }
+    if(display) namedWindow("Ellipse");
+
+    // Ellipse finder object reusing its buffers and warm starting from the previous frame
+    ellipseFinder ef(canny_l, canny_h, rp);
+    Mat frame;
+    int frames = 0, found = 0;
+    double seconds = 0;
+    while(cap.read(frame)) {
+        int64 start = getTickCount();
+        if(ef.process(frame)) found++;
+        seconds += (getTickCount() - start) / getTickFrequency();
+        frames++;
+
+        if(frames % 100 == 0)
+            cout << frames << " frames, " << found << " found, " << 1000 * seconds / frames << " ms/frame" << endl;
+
+        if(display) {
+            ef.show();
+            if(char(waitKey(1)) == 'q') break;
+        }
+    }
 
-    while(char(waitKey(1)) != 'q') {}
+    if(frames > 0)
+        cout << frames << " frames, " << found << " found, " << 1000 * seconds / frames << " ms/frame ("
+             << frames / seconds << " fps)" << endl;
 
     return 0;
 }